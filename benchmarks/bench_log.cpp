@@ -0,0 +1,202 @@
+// Call latency and multi-threaded throughput of utils::log. Results are written to stdout as JSON,
+// one object per benchmark, so runs can be compared by a script.
+//
+// usage: bench_log [iterations] [max_threads]
+
+#include "log.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <print>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace utils::log;
+
+#ifdef _WIN32
+constexpr const char* null_device = "NUL";
+#else
+constexpr const char* null_device = "/dev/null";
+#endif // _WIN32
+
+struct NullSink {
+    static void write(const std::string_view) noexcept {}
+    static void flush() noexcept {}
+};
+
+class Report {
+public:
+    void latency(const std::string& name, std::vector<u64>& ticks, const double ns_per_tick) {
+        std::ranges::sort(ticks);
+        const auto percentile = [&](const double p) {
+            const auto rank = static_cast<std::size_t>(p * static_cast<double>(ticks.size()));
+            const std::size_t index = std::min(ticks.size() - 1, rank);
+            return static_cast<double>(ticks[index]) * ns_per_tick;
+        };
+        double total = 0;
+        for (const u64 t : ticks) total += static_cast<double>(t);
+
+        add(std::format(R"({{"name": "{}", "kind": "latency", "iterations": {}, "mean_ns": {:.1f}, )"
+                        R"("p50_ns": {:.1f}, "p99_ns": {:.1f}, "p999_ns": {:.1f}, "max_ns": {:.1f}}})",
+                        name, ticks.size(), total / static_cast<double>(ticks.size()) * ns_per_tick, percentile(0.5),
+                        percentile(0.99), percentile(0.999), static_cast<double>(ticks.back()) * ns_per_tick));
+    }
+
+    void throughput(const std::string& name, const unsigned threads, const u64 messages, const double seconds) {
+        add(std::format(R"({{"name": "{}", "kind": "throughput", "threads": {}, "messages": {}, )"
+                        R"("seconds": {:.6f}, "messages_per_second": {:.0f}}})",
+                        name, threads, messages, seconds, static_cast<double>(messages) / seconds));
+    }
+
+    void print() const {
+        std::println("{{\"benchmarks\": [");
+        for (std::size_t i = 0; i < m_entries.size(); ++i) {
+            std::println("  {}{}", m_entries[i], i + 1 < m_entries.size() ? "," : "");
+        }
+        std::println("]}}");
+    }
+
+private:
+    void add(std::string entry) {
+        std::println(stderr, "{}", entry);
+        m_entries.push_back(MOVE(entry));
+    }
+
+    std::vector<std::string> m_entries;
+};
+
+// Times every call separately in FastClock ticks, the ticks are converted with a rate measured
+// against steady_clock over the whole run and the cost of reading the clock is subtracted
+template <typename F>
+void measure_latency(Report& report, const std::string& name, const std::size_t iterations, F&& call) {
+    using utils::log::detail::FastClock;
+
+    std::vector<u64> ticks(iterations);
+    u64 overhead = ~u64{0};
+    for (int i = 0; i < 1000; ++i) {
+        const u64 start = FastClock::ticks();
+        overhead = std::min(overhead, FastClock::ticks() - start);
+    }
+
+    for (std::size_t i = 0; i < iterations / 10; ++i) call(i); // warm up caches and queues
+
+    const auto wall_start = std::chrono::steady_clock::now();
+    const u64 ticks_start = FastClock::ticks();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        const u64 start = FastClock::ticks();
+        call(i);
+        const u64 elapsed = FastClock::ticks() - start;
+        ticks[i] = elapsed > overhead ? elapsed - overhead : 0;
+    }
+    const u64 ticks_total = FastClock::ticks() - ticks_start;
+    const auto wall_total = std::chrono::steady_clock::now() - wall_start;
+
+    const double ns_per_tick = static_cast<double>(std::chrono::nanoseconds(wall_total).count()) /
+                               static_cast<double>(ticks_total == 0 ? 1 : ticks_total);
+    report.latency(name, ticks, ns_per_tick);
+}
+
+// Every thread logs iterations records, the time includes writing all of them to the sink
+void measure_throughput(Report& report, const std::size_t iterations, const unsigned threads) {
+    set_sink(NullSink{});
+    start_async({.queue_capacity = std::size_t{1} << 22});
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::jthread> workers;
+    workers.reserve(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([iterations, t] {
+            for (std::size_t i = 0; i < iterations; ++i) INFO("thread {} message {} value {}", t, i, 0.5);
+        });
+    }
+    workers.clear();
+    flush();
+    const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    stop_async();
+    report.throughput("async/null/INFO", threads, iterations * threads, seconds.count());
+}
+
+void latency_benchmarks(Report& report, const std::size_t iterations) {
+    set_log_level(LogLevel::INFO);
+
+    set_sink(NullSink{});
+    measure_latency(report, "disabled/DEBUG", iterations, [](const std::size_t i) { DEBUG("value {}", i); });
+    measure_latency(report, "disabled/DEBUG_KV", iterations,
+                    [](const std::size_t i) { DEBUG_KV("value", "i", i); });
+
+    const auto info = [](const std::size_t i) { INFO("request {} took {}us", i, 17.5); };
+    measure_latency(report, "sync/null/INFO", iterations, info);
+    measure_latency(report, "sync/null/INFO_KV", iterations,
+                    [](const std::size_t i) { INFO_KV("request", "id", i, "us", 17.5); });
+    measure_latency(report, "sync/null/INFO_EVERY_N", iterations,
+                    [](const std::size_t i) { INFO_EVERY_N(100, "request {}", i); });
+
+    set_timestamp_precision(TimestampPrecision::Microseconds);
+    measure_latency(report, "sync/null/INFO+timestamp", iterations, info);
+    set_timestamp_precision(TimestampPrecision::None);
+
+    if (auto sink = FdSink::open(null_device)) {
+        set_sink(MOVE(*sink));
+        measure_latency(report, "sync/fd/INFO", iterations, info);
+    }
+
+    set_sink(RingSink(std::size_t{1} << 20));
+    measure_latency(report, "sync/ring/INFO", iterations, info);
+
+    set_sink(NullSink{});
+    enable_buffering();
+    measure_latency(report, "sync/null/INFO+buffering", iterations, info);
+    disable_buffering();
+
+    start_async({.queue_capacity = std::size_t{1} << 24});
+    measure_latency(report, "async/null/INFO", iterations, info);
+    measure_latency(report, "async/null/INFO_string", iterations,
+                    [](const std::size_t i) { INFO("request {} from {}", i, std::string_view("localhost")); });
+    stop_async();
+
+    start_async({.queue_capacity = std::size_t{1} << 24, .deferred_format = false});
+    measure_latency(report, "async/null/INFO_eager", iterations, info);
+    stop_async();
+
+#ifndef _WIN32
+    const std::string binary_path = "bench_log.bin";
+    if (auto sink = BinaryFileSink::open(binary_path)) {
+        set_binary_sink(MOVE(*sink));
+        start_async({.queue_capacity = std::size_t{1} << 24});
+        measure_latency(report, "async/binary/INFO", iterations, info);
+        stop_async();
+        reset_binary_sink();
+        std::remove(binary_path.c_str());
+    }
+#endif // _WIN32
+
+    set_sink(StderrSink{});
+}
+
+} // namespace
+
+int main(const int argc, char** argv) {
+    const std::size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200'000;
+    const unsigned hardware = std::max(1U, std::thread::hardware_concurrency());
+    const unsigned max_threads = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : hardware;
+    if (iterations == 0 || max_threads == 0) {
+        std::println(stderr, "usage: {} [iterations] [max_threads]", argv[0]);
+        return 1;
+    }
+
+    Report report;
+    latency_benchmarks(report, iterations);
+    for (unsigned threads = 1;; threads = std::min(threads * 2, max_threads)) {
+        measure_throughput(report, iterations, threads);
+        if (threads == max_threads) break;
+    }
+
+    report.print();
+    return 0;
+}
@@ -0,0 +1,426 @@
+// Throughput of the utils::string algorithms on large inputs. Results are written to stdout as JSON,
+// one object per benchmark, so runs can be compared by a script.
+//
+// usage: bench_string [megabytes] [repetitions]
+
+#include "string.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory_resource>
+#include <print>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace {
+
+using namespace utils::string;
+
+// Keeps the optimizer from dropping the work being measured
+volatile std::size_t sink = 0;
+
+class Report {
+public:
+    void add(const std::string& name, const std::size_t bytes, std::vector<double>& seconds) {
+        std::ranges::sort(seconds);
+        const double median = seconds[seconds.size() / 2];
+        std::string entry = std::format(R"({{"name": "{}", "bytes": {}, "repetitions": {}, "median_seconds": {:.6f}, )"
+                                        R"("min_seconds": {:.6f}, "megabytes_per_second": {:.1f}}})",
+                                        name, bytes, seconds.size(), median, seconds.front(),
+                                        static_cast<double>(bytes) / median / 1e6);
+        std::println(stderr, "{}", entry);
+        m_entries.push_back(MOVE(entry));
+    }
+
+    void print() const {
+        std::println("{{\"benchmarks\": [");
+        for (std::size_t i = 0; i < m_entries.size(); ++i) {
+            std::println("  {}{}", m_entries[i], i + 1 < m_entries.size() ? "," : "");
+        }
+        std::println("]}}");
+    }
+
+private:
+    std::vector<std::string> m_entries;
+};
+
+void measure(Report& report, const std::string& name, const std::string_view input, const std::size_t repetitions,
+             const std::function<std::size_t(std::string_view)>& run) {
+    sink = sink + run(input); // warm up
+    std::vector<double> seconds;
+    seconds.reserve(repetitions);
+    for (std::size_t i = 0; i < repetitions; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        sink = sink + run(input);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        seconds.push_back(elapsed.count());
+    }
+    report.add(name, input.size(), seconds);
+}
+
+// A CSV-like line of fields between 1 and 24 bytes long
+std::string make_csv(const std::size_t bytes, const std::string_view delimiter) {
+    std::string result;
+    result.reserve(bytes + 32);
+    u32 state = 0x9e3779b9U;
+    while (result.size() < bytes) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        const std::size_t length = 1 + state % 24;
+        for (std::size_t i = 0; i < length; ++i) result += static_cast<char>('a' + (state >> i) % 26);
+        result += delimiter;
+    }
+    return result;
+}
+
+void split_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    for (const std::string_view delimiter : {",", ", "}) {
+        const std::string input = make_csv(bytes, delimiter);
+        const std::string suffix = delimiter.size() == 1 ? "byte" : "string";
+
+        measure(report, "split/" + suffix, input, repetitions,
+                [delimiter](const std::string_view str) { return split(str, delimiter).size(); });
+        measure(report, "split_view/vector/" + suffix, input, repetitions,
+                [delimiter](const std::string_view str) { return split_view(str, delimiter).size(); });
+
+        std::vector<std::string_view> out(input.size());
+        measure(report, "split_view/span/" + suffix, input, repetitions,
+                [delimiter, &out](const std::string_view str) { return split_view(str, delimiter, out); });
+    }
+}
+
+// Words separated by single spaces, with a run of mixed whitespace every few words
+std::string make_text(const std::size_t bytes) {
+    std::string result = make_csv(bytes, " ");
+    for (std::size_t i = 97; i < result.size(); i += 97) {
+        if (result[i] == ' ') result.replace(i, 1, " \t\n  ");
+    }
+    return result;
+}
+
+void trim_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    const std::string padding(bytes / 2, ' ');
+    const std::string padded = padding + "x" + padding;
+    measure(report, "trim_view/padded", padded, repetitions,
+            [](const std::string_view str) { return trim_view(str).size(); });
+
+    // Both include copying the input, as the functions work in place
+    const std::string text = make_text(bytes);
+    measure(report, "copy/text", text, repetitions, [](const std::string_view str) { return std::string(str).size(); });
+    measure(report, "trim_and_reduce/text", text, repetitions,
+            [](const std::string_view str) { return trim_and_reduce(std::string(str)).size(); });
+}
+
+// Markup-like text where roughly one byte in ten is part of a match
+void replace_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    std::string text = make_text(bytes);
+    for (std::size_t i = 50; i < text.size(); i += 50) text[i] = i % 150 == 0 ? '<' : (i % 100 == 0 ? '&' : '>');
+
+    measure(report, "replace_all/grow", text, repetitions,
+            [](const std::string_view str) { return replace_all(std::string(str), "<", "&lt;").size(); });
+    measure(report, "replace_all/shrink", text, repetitions,
+            [](const std::string_view str) { return replace_all(std::string(str), "ab", "x").size(); });
+    measure(report, "replace_all/same_size", text, repetitions,
+            [](const std::string_view str) { return replace_all(std::string(str), "ab", "ba").size(); });
+
+    measure(report, "replace_all/chained", text, repetitions, [](const std::string_view str) {
+        std::string result(str);
+        replace_all_in_place(result, "&", "&amp;");
+        replace_all_in_place(result, "<", "&lt;");
+        replace_all_in_place(result, ">", "&gt;");
+        return result.size();
+    });
+    const Replacer escape{{"&", "&amp;"}, {"<", "&lt;"}, {">", "&gt;"}};
+    measure(report, "Replacer/escape", text, repetitions,
+            [&escape](const std::string_view str) { return escape.replace(str).size(); });
+}
+
+void ascii_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    std::string text = make_text(bytes);
+    for (std::size_t i = 0; i < text.size(); i += 3) text[i] = ascii::to_upper(text[i]);
+    std::string out(text.size(), '\0');
+
+    measure(report, "to_lower/scalar", text, repetitions, [&out](const std::string_view str) {
+        for (std::size_t i = 0; i < str.size(); ++i) out[i] = ascii::to_lower(str[i]);
+        return out.size();
+    });
+    measure(report, "to_lower/bulk", text, repetitions, [&out](const std::string_view str) {
+        ascii::to_lower(str, out.data());
+        return out.size();
+    });
+
+    const std::string alnum(bytes, 'a');
+    measure(report, "all_of_alnum/scalar", alnum, repetitions, [](const std::string_view str) {
+        return static_cast<std::size_t>(std::ranges::all_of(str, [](const char c) { return ascii::is_alnum(c); }));
+    });
+    measure(report, "all_of_alnum/bulk", alnum, repetitions,
+            [](const std::string_view str) { return static_cast<std::size_t>(ascii::all_of_alnum(str)); });
+}
+
+// Header lookups by a differently cased name, the input is the names one after another
+void lookup_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    const std::vector<std::string> names = {
+        "Accept", "Accept-Encoding", "Authorization", "Cache-Control", "Content-Length", "Content-Type",
+        "Cookie", "Host", "If-None-Match", "Origin", "Referer", "User-Agent", "X-Forwarded-For", "X-Request-Id",
+    };
+    std::unordered_map<std::string, std::size_t> lowered;
+    std::unordered_map<std::string, std::size_t, ihash, iequal_to> folded;
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        std::string name = names[i];
+        ascii::to_lower_in_place(name);
+        lowered.emplace(name, i);
+        folded.emplace(names[i], i);
+    }
+
+    std::string input;
+    std::vector<std::string_view> keys;
+    for (std::size_t i = 0; input.size() < bytes; ++i) {
+        std::string name = names[i % names.size()];
+        if (i % 2 == 0) ascii::to_upper_in_place(name);
+        input += name;
+    }
+    for (std::size_t pos = 0, i = 0; pos < input.size(); pos += names[i++ % names.size()].size()) {
+        keys.push_back(std::string_view(input).substr(pos, names[i % names.size()].size()));
+    }
+
+    measure(report, "lookup/lowercase_copy", input, repetitions, [&](std::string_view) {
+        std::size_t sum = 0;
+        for (const std::string_view key : keys) {
+            std::string name(key);
+            ascii::to_lower_in_place(name);
+            sum += lowered.find(name)->second;
+        }
+        return sum;
+    });
+    measure(report, "lookup/ihash", input, repetitions, [&](std::string_view) {
+        std::size_t sum = 0;
+        for (const std::string_view key : keys) sum += folded.find(key)->second;
+        return sum;
+    });
+}
+
+// Dispatch on command names, the input is the names one after another
+void match_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    static constexpr std::array<std::string_view, 12> names = {
+        "get", "set", "delete", "exists", "expire", "incr", "decr", "append", "rename", "scan", "keys", "ttl",
+    };
+    static constexpr PerfectHash<names.size()> commands(names);
+
+    std::string input;
+    for (std::size_t i = 0; input.size() < bytes; ++i) input += names[(i * 7) % names.size()];
+    std::vector<std::string_view> keys;
+    for (std::size_t pos = 0, i = 0; pos < input.size(); ++i) {
+        keys.push_back(std::string_view(input).substr(pos, names[(i * 7) % names.size()].size()));
+        pos += keys.back().size();
+    }
+
+    measure(report, "match/compare_chain", input, repetitions, [&](std::string_view) {
+        std::size_t sum = 0;
+        for (const std::string_view key : keys) {
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                if (key == names[i]) {
+                    sum += i;
+                    break;
+                }
+            }
+        }
+        return sum;
+    });
+    measure(report, "match/PerfectHash", input, repetitions, [&](std::string_view) {
+        std::size_t sum = 0;
+        for (const std::string_view key : keys) sum += commands.match(key);
+        return sum;
+    });
+}
+
+// Counting repeated keys of a CSV line, by copying each into a std::string or through an Interner
+void intern_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    std::string input;
+    for (std::size_t i = 0; input.size() < bytes; ++i) input += "key-" + std::to_string((i * 7919) % 4096) + ',';
+    const std::vector<std::string_view> fields = split_view(input, ",");
+
+    measure(report, "intern/unordered_map", input, repetitions, [&](std::string_view) {
+        std::unordered_map<std::string, std::size_t> counts;
+        for (const std::string_view field : fields) ++counts[std::string(field)];
+        return counts.size();
+    });
+    measure(report, "intern/Interner", input, repetitions, [&](std::string_view) {
+        Interner interner;
+        std::vector<std::size_t> counts;
+        for (const std::string_view field : fields) {
+            const Interner::Id id = interner.intern(field);
+            if (id >= counts.size()) counts.resize(id + std::size_t{1});
+            ++counts[id];
+        }
+        return interner.size();
+    });
+
+    Interner interner;
+    for (const std::string_view field : fields) interner.intern(field);
+    measure(report, "intern/Interner/find", input, repetitions, [&](std::string_view) {
+        std::size_t sum = 0;
+        for (const std::string_view field : fields) sum += interner.find(field);
+        return sum;
+    });
+}
+
+#ifndef _WIN32
+// Counting the lines of a log file, read in full and split, with std::getline and with a LineReader
+void line_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    const std::string filename = "bench_string_lines.txt";
+    const std::string text = make_csv(bytes, "\n");
+    if (FILE* file = std::fopen(filename.c_str(), "wb")) {
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fclose(file);
+    }
+
+    measure(report, "lines/read+split_view", text, repetitions, [&](std::string_view) {
+        std::ifstream file(filename, std::ios::binary);
+        const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return split_view(contents, "\n").size();
+    });
+    measure(report, "lines/getline", text, repetitions, [&](std::string_view) {
+        std::ifstream file(filename, std::ios::binary);
+        std::size_t count = 0;
+        for (std::string line; std::getline(file, line);) ++count;
+        return count;
+    });
+    measure(report, "lines/LineReader/mapped", text, repetitions, [&](std::string_view) {
+        auto reader = LineReader::open(filename);
+        return static_cast<std::size_t>(std::ranges::distance(reader->begin(), reader->end()));
+    });
+    measure(report, "lines/LineReader/read", text, repetitions, [&](std::string_view) {
+        const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        LineReader reader(fd);
+        const auto count = static_cast<std::size_t>(std::ranges::distance(reader.begin(), reader.end()));
+        ::close(fd);
+        return count;
+    });
+
+    std::remove(filename.c_str());
+}
+#endif // _WIN32
+
+// A column of integers with up to 18 digits and one of doubles, separated by commas
+void number_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    std::string integers;
+    std::string doubles;
+    u64 state = 0x2545f4914f6cdd1dULL;
+    for (std::size_t i = 0; integers.size() < bytes; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        integers += std::to_string(state >> (state % 64 + 4) % 64) + ',';
+        std::array<char, max_chars<double>> buffer{};
+        if (doubles.size() < bytes) {
+            doubles += std::string(format_number(buffer, std::bit_cast<double>(state >> 2))) + ',';
+        }
+    }
+    const std::vector<std::string_view> integer_fields = split_view(integers, ",");
+    const std::vector<std::string_view> double_fields = split_view(doubles, ",");
+    std::vector<u64> integer_values(integer_fields.size());
+    std::vector<double> double_values(double_fields.size());
+
+    measure(report, "parse/u64/from_chars", integers, repetitions, [&](std::string_view) {
+        for (std::size_t i = 0; i < integer_fields.size(); ++i) {
+            const std::string_view field = integer_fields[i];
+            std::from_chars(field.data(), field.data() + field.size(), integer_values[i]);
+        }
+        return integer_values.back();
+    });
+    measure(report, "parse/u64/parse_all", integers, repetitions, [&](std::string_view) {
+        return parse_all<u64>(integer_fields, integer_values).count;
+    });
+    measure(report, "parse/double/parse_all", doubles, repetitions, [&](std::string_view) {
+        return parse_all<double>(double_fields, double_values).count;
+    });
+    measure(report, "format/double", doubles, repetitions, [&](std::string_view) {
+        std::size_t total = 0;
+        std::array<char, max_chars<double>> buffer{};
+        for (const double value : double_values) total += format_number(buffer, value).size();
+        return total;
+    });
+}
+
+// A JSON-like response of many small formatted records, the input only sets the output size
+void build_benchmarks(Report& report, const std::size_t bytes, const std::size_t repetitions) {
+    const std::string input(bytes, ' ');
+    const auto records = [](const std::size_t size, const auto& emit) {
+        for (std::size_t i = 0, written = 0; written < size; ++i) written += emit(i);
+    };
+
+    measure(report, "build/string+format", input, repetitions, [&](const std::string_view str) {
+        std::string out;
+        records(str.size(), [&out](const std::size_t i) {
+            const std::size_t before = out.size();
+            out += std::format(R"({{"id": {}, "score": {}, "name": "user{}"}},)", i, static_cast<double>(i) * 0.25, i);
+            return out.size() - before;
+        });
+        return out.size();
+    });
+
+    std::vector<std::byte> buffer(2 * bytes + (std::size_t{1} << 20));
+    measure(report, "build/Builder+arena", input, repetitions, [&](const std::string_view str) {
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+        Builder<> out(&arena);
+        records(str.size(), [&out](const std::size_t i) {
+            const std::size_t before = out.size();
+            out.format(R"({{"id": {}, "score": {}, "name": "user{}"}},)", i, static_cast<double>(i) * 0.25, i);
+            return out.size() - before;
+        });
+        return out.piece_count() + out.size();
+    });
+    measure(report, "build/Builder+arena+str", input, repetitions, [&](const std::string_view str) {
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+        Builder<> out(&arena);
+        records(str.size(), [&out](const std::size_t i) {
+            const std::size_t before = out.size();
+            out.format(R"({{"id": {}, "score": {}, "name": "user{}"}},)", i, static_cast<double>(i) * 0.25, i);
+            return out.size() - before;
+        });
+        return out.str().size();
+    });
+}
+
+} // namespace
+
+int main(const int argc, char** argv) {
+    const std::size_t megabytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 16;
+    const std::size_t repetitions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 15;
+    if (megabytes == 0 || repetitions == 0) {
+        std::println(stderr, "usage: {} [megabytes] [repetitions]", argv[0]);
+        return 1;
+    }
+
+    Report report;
+    split_benchmarks(report, megabytes << 20, repetitions);
+    trim_benchmarks(report, megabytes << 20, repetitions);
+    replace_benchmarks(report, megabytes << 20, repetitions);
+    ascii_benchmarks(report, megabytes << 20, repetitions);
+    lookup_benchmarks(report, megabytes << 20, repetitions);
+    match_benchmarks(report, megabytes << 20, repetitions);
+    intern_benchmarks(report, megabytes << 20, repetitions);
+#ifndef _WIN32
+    line_benchmarks(report, megabytes << 20, repetitions);
+#endif // _WIN32
+    number_benchmarks(report, megabytes << 20, repetitions);
+    build_benchmarks(report, megabytes << 20, repetitions);
+
+    report.print();
+    return 0;
+}
@@ -32,8 +32,33 @@ using f64 = double;
 
 #define UNUSED(x) (void)(x)
 
+namespace utils {
+
+using AbortHandler = void (*)();
+
+inline AbortHandler& abort_handler() noexcept {
+    static AbortHandler handler = nullptr;
+    return handler;
+}
+
+// Called by TODO and ASSERT before they print their message and abort, e.g. log.hpp uses it to
+// write out buffered lines so they come before the message. Returns the previous handler so it
+// can be chained.
+inline AbortHandler set_abort_handler(const AbortHandler handler) noexcept {
+    const AbortHandler previous = abort_handler();
+    abort_handler() = handler;
+    return previous;
+}
+
+inline void run_abort_handler() noexcept {
+    if (const AbortHandler handler = abort_handler()) handler();
+}
+
+} // namespace utils
+
 #ifndef NDEBUG
 [[noreturn]] constexpr void TODO(const char* message = nullptr, const std::source_location loc = std::source_location::current()) {
+    utils::run_abort_handler();
     if (message == nullptr) {
         std::println(stderr, "TODO at [{}:{}]", loc.file_name(), loc.line());
     } else {
@@ -48,6 +73,7 @@ using f64 = double;
 #ifndef NDEBUG
 constexpr void ASSERT(const bool condition, const char* message = nullptr, const std::source_location loc = std::source_location::current()) {
     if (!condition) {
+        utils::run_abort_handler();
         if (message == nullptr) {
             std::println(stderr, "Assert failed at [{}:{}]", loc.file_name(), loc.line());
         } else {
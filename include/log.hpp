@@ -11,16 +11,71 @@
 
 #include "common.hpp"
 
+// process_compressor runs gzip and the like through process.hpp, which logging does not need
+// otherwise. Define UTILS_LOG_PROCESS_COMPRESSOR to get it, and UTILS_PROCESS_IMPLEMENTATION in
+// one translation unit to link it
+#ifdef UTILS_LOG_PROCESS_COMPRESSOR
+#include "process.hpp"
+#endif // UTILS_LOG_PROCESS_COMPRESSOR
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <condition_variable>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <expected>
 #include <format>
-#include <iostream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define UTILS_LOG_HAS_BACKTRACE 1
+#else
+#define UTILS_LOG_HAS_BACKTRACE 0
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 // TODOs
-// - Thread safety
-// - Sink concept and custom sinks
 // - Color customization?
-// - Datetime?
-// - Flush all messages and buffered messages
 // - More performance is easily achievable probably
 //   - e.g. currently buffer is useless when color is disabled
 
@@ -32,138 +87,3318 @@ constexpr std::strong_ordering operator<=>(const LogLevel lhs, const LogLevel rh
     return static_cast<u8>(lhs) <=> static_cast<u8>(rhs);
 }
 
-namespace color {
+// Compile-time threshold as the numeric value of a LogLevel, e.g. -DUTILS_LOG_MIN_LEVEL=1
+// removes every DEBUG call including the evaluation of its arguments
+#ifndef UTILS_LOG_MIN_LEVEL
+#define UTILS_LOG_MIN_LEVEL 0
+#endif // UTILS_LOG_MIN_LEVEL
 
-// clang-format off
-inline constexpr std::string_view black   = "\033[30m";
-inline constexpr std::string_view red     = "\033[31m";
-inline constexpr std::string_view green   = "\033[32m";
-inline constexpr std::string_view yellow  = "\033[33m";
-inline constexpr std::string_view blue    = "\033[34m";
-inline constexpr std::string_view magenta = "\033[35m";
-inline constexpr std::string_view cyan    = "\033[36m";
-inline constexpr std::string_view white   = "\033[37m";
+static_assert(UTILS_LOG_MIN_LEVEL >= 0 && UTILS_LOG_MIN_LEVEL <= 4, "UTILS_LOG_MIN_LEVEL must be between 0 and 4");
+inline constexpr LogLevel min_level = static_cast<LogLevel>(UTILS_LOG_MIN_LEVEL);
 
-inline constexpr std::string_view reset   = "\033[0m";
-// clang-format on
+// What a producer thread does when its queue has no room for a new record in async mode
+enum class OverflowPolicy : u8 {
+    // Spin until the backend thread frees enough space
+    Block,
 
-} // namespace color
+    // Discard the record, the backend periodically reports how many were dropped
+    Drop,
+
+    // Continue in a new queue twice the size, the old one is released once drained
+    Grow,
+};
+
+struct AsyncOptions {
+    // Initial size in bytes of each producer thread's queue, rounded up to a power of two
+    std::size_t queue_capacity = std::size_t{1} << 20;
+    OverflowPolicy overflow = OverflowPolicy::Block;
+
+    // How long the backend thread sleeps when every queue is empty
+    std::chrono::microseconds idle_sleep{100};
+
+    // Copy the raw arguments into the queue and run std::vformat on the backend thread.
+    // Calls with an argument that is not deferrable are still formatted on the caller thread.
+    bool deferred_format = true;
+};
+
+// Lines are collected and handed to the sink in one vectored write once either limit is hit.
+// In sync mode the delay is only checked when the next line comes in, call flush() to force it.
+struct BufferOptions {
+    std::size_t max_bytes = std::size_t{64} << 10;
+    std::chrono::milliseconds max_delay{100};
+};
+
+struct CrashHandlerOptions {
+    // Where the crash report goes, a negative fd skips the report and only flushes
+    int fd = 2;
+
+    // How much of the most recent log output is kept in memory for the report
+    std::size_t recent_bytes = std::size_t{16} << 10;
+
+    // Include a stack trace where <execinfo.h> is available
+    bool backtrace = true;
+};
+
+// Fractional digits of the timestamp in front of every text line, None leaves it out
+enum class TimestampPrecision : u8 { None, Seconds, Milliseconds, Microseconds, Nanoseconds };
+
+// Line format of the _KV macros
+enum class KvFormat : u8 {
+    // level=INFO msg="user logged in" user=42
+    Logfmt,
+
+    // {"level":"INFO","msg":"user logged in","user":42}
+    Json,
+};
+
+// Argument types that can be copied byte-wise into a queue and formatted later. Specialize it
+// for trivially copyable types that own all of their data, e.g. a plain struct of numbers.
+// Strings are always deferrable, their contents are copied into the record.
+template <typename T>
+struct is_deferrable : std::bool_constant<std::is_arithmetic_v<T> || std::is_same_v<T, std::nullptr_t> ||
+                                          std::is_same_v<T, void*> || std::is_same_v<T, const void*>> {};
 
 namespace detail {
 
-struct logger {
-    static logger& instance() {
-        static logger logger;
-        return logger;
+inline std::string errno_message(const std::string_view what, const std::string_view path) {
+    return std::format("{} '{}': {}", what, path, std::system_category().message(errno));
+}
+
+inline int open_for_append(const std::string& path) noexcept {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif // _WIN32
+}
+
+inline int process_id() noexcept {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return ::getpid();
+#endif // _WIN32
+}
+
+inline void close_file(const int fd) noexcept {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif // _WIN32
+}
+
+// Writes everything unless the fd reports an error, partial writes are retried
+inline void write_all(const int fd, std::string_view data) noexcept {
+    while (!data.empty()) {
+#ifdef _WIN32
+        constexpr std::size_t max_chunk = 1U << 30;
+        const std::size_t chunk = data.size() < max_chunk ? data.size() : max_chunk;
+        const int written = _write(fd, data.data(), static_cast<unsigned>(chunk));
+#else
+        const ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0 && errno == EINTR) continue;
+#endif // _WIN32
+        if (written <= 0) return;
+        data.remove_prefix(static_cast<std::size_t>(written));
     }
+}
 
-    logger(const logger&) = delete;
-    logger& operator=(const logger&) = delete;
+// write_all for several pieces with as few writev calls as possible
+inline void write_all_v(const int fd, std::span<const std::string_view> pieces) noexcept {
+#ifdef _WIN32
+    for (const std::string_view piece : pieces) write_all(fd, piece);
+#else
+    constexpr std::size_t max_pieces = 64;
+    std::array<iovec, max_pieces> iov{};
+    std::size_t offset = 0; // bytes of the first piece that are already written
 
-    // Temporarily here, will be moved to sink
-    void set_log_level(const LogLevel level) {
-        m_level = level;
+    while (!pieces.empty()) {
+        std::size_t count = 0;
+        for (; count < pieces.size() && count < max_pieces; ++count) {
+            const std::string_view piece = count == 0 ? pieces[0].substr(offset) : pieces[count];
+            iov[count] = {const_cast<char*>(piece.data()), piece.size()};
+        }
+
+        const ssize_t written = ::writev(fd, iov.data(), static_cast<int>(count));
+        if (written < 0 && errno == EINTR) continue;
+        if (written < 0) return;
+
+        auto remaining = static_cast<std::size_t>(written);
+        while (!pieces.empty() && remaining >= pieces[0].size() - offset) {
+            remaining -= pieces[0].size() - offset;
+            offset = 0;
+            pieces = pieces.subspan(1);
+        }
+        if (written == 0 && !pieces.empty()) return;
+        offset += remaining;
     }
+#endif // _WIN32
+}
 
-    [[nodiscard]] LogLevel log_level() const {
-        return m_level;
+} // namespace detail
+
+// Anything with write and flush can receive formatted log lines. Each write call gets one
+// or more complete lines, calls are serialized by the logger.
+template <typename S>
+concept Sink = requires(S& sink, const std::string_view data) {
+    sink.write(data);
+    sink.flush();
+};
+
+// Sinks may also accept several pieces at once, the logger hands over buffered lines this way
+template <typename S>
+concept VectoredSink = Sink<S> && requires(S& sink, const std::span<const std::string_view> pieces) {
+    sink.write_v(pieces);
+};
+
+namespace detail {
+
+template <Sink S>
+void write_pieces(S& sink, const std::span<const std::string_view> pieces) {
+    if constexpr (VectoredSink<S>) {
+        sink.write_v(pieces);
+    } else {
+        for (const std::string_view piece : pieces) sink.write(piece);
     }
+}
 
-    template <LogLevel L, typename... Args>
-    constexpr void log(const std::format_string<Args...> fmt, Args&&... args) {
-        if (L < m_level) return;
-        write_log(L, std::format(fmt, FORWARD(args)...));
+} // namespace detail
+
+// Unbuffered writes to file descriptor 2, the default sink
+class StderrSink {
+public:
+    static int fd() noexcept {
+        return 2;
     }
 
-    template <typename... Args>
-    constexpr void debug(const std::format_string<Args...> fmt, std::string_view file, int line, Args&&... args) {
-        if (LogLevel::DEBUG < m_level) return;
-        write_log(LogLevel::DEBUG,
-                  std::format("[{}:{}] {}", file, line, std::format(fmt, FORWARD(args)...)));
+    static void write(const std::string_view data) noexcept {
+        detail::write_all(2, data);
+    }
+
+    static void write_v(const std::span<const std::string_view> pieces) noexcept {
+        detail::write_all_v(2, pieces);
+    }
+
+    static void flush() noexcept {}
+};
+
+// Writes to a raw file descriptor without any buffering
+class FdSink {
+public:
+    explicit FdSink(const int fd, const bool owned = false) noexcept : m_fd(fd), m_owned(owned) {}
+
+    // Opens the file in append mode, the sink closes it on destruction
+    static std::expected<FdSink, std::string> open(const std::string& path) {
+        const int fd = detail::open_for_append(path);
+        if (fd < 0) return std::unexpected(detail::errno_message("Could not open log file", path));
+        return FdSink(fd, true);
+    }
+
+    FdSink(const FdSink&) = delete;
+    FdSink& operator=(const FdSink&) = delete;
+
+    FdSink(FdSink&& other) noexcept : m_fd(std::exchange(other.m_fd, -1)), m_owned(other.m_owned) {}
+
+    FdSink& operator=(FdSink&& other) noexcept {
+        if (this != &other) {
+            reset();
+            m_fd = std::exchange(other.m_fd, -1);
+            m_owned = other.m_owned;
+        }
+        return *this;
+    }
+
+    ~FdSink() {
+        reset();
+    }
+
+    [[nodiscard]] int fd() const noexcept {
+        return m_fd;
     }
 
+    void write(const std::string_view data) const noexcept {
+        detail::write_all(m_fd, data);
+    }
+
+    void write_v(const std::span<const std::string_view> pieces) const noexcept {
+        detail::write_all_v(m_fd, pieces);
+    }
+
+    static void flush() noexcept {}
+
 private:
-    logger() = default;
-    ~logger() = default;
+    void reset() noexcept {
+        if (m_owned && m_fd >= 0) detail::close_file(m_fd);
+        m_fd = -1;
+    }
+
+    int m_fd;
+    bool m_owned;
+};
 
-    static std::ostream& out() {
-        return std::cerr;
+// Replaces a closed log file with a compressed file named path + suffix
+struct Compressor {
+    std::string suffix;
+    std::function<std::expected<void, std::string>(const std::string& path)> compress;
+};
+
+#ifdef UTILS_LOG_PROCESS_COMPRESSOR
+// Runs command followed by the file path as a child process through utils::process, e.g.
+// process_compressor({"gzip", "-f"}, ".gz")
+inline Compressor process_compressor(std::vector<std::string> command, std::string suffix) {
+    return {MOVE(suffix), [command = MOVE(command)](const std::string& path) -> std::expected<void, std::string> {
+                std::vector<std::string> args = command;
+                args.push_back(path);
+                const auto proc = utils::process::run_async(args);
+                if (!proc) return std::unexpected(proc.error());
+                return utils::process::wait_proc(*proc);
+            }};
+}
+#endif // UTILS_LOG_PROCESS_COMPRESSOR
+
+struct RotationOptions {
+    // Rotate before a write would make the file larger than this, 0 disables
+    std::size_t max_size = 0;
+
+    // Rotate once the file has been open this long, 0 disables
+    std::chrono::milliseconds max_age{0};
+
+    // Number of rotated files to keep
+    std::size_t max_files = 5;
+
+    std::optional<Compressor> compressor{};
+
+    // Time source for max_age, steady_clock when empty
+    std::function<std::chrono::steady_clock::time_point()> clock{};
+};
+
+namespace detail {
+
+// Shifts, deletes and compresses rotated files on its own thread, in the order they were closed
+class RotationWorker {
+public:
+    RotationWorker(std::string path, const std::size_t max_files, std::optional<Compressor> compressor)
+        : m_path(MOVE(path)), m_max_files(max_files), m_compressor(MOVE(compressor)) {
+        m_thread = std::jthread([this](const std::stop_token& token) { run(token); });
     }
 
-    static constexpr std::string_view to_string(const LogLevel level) {
-        // clang-format off
-        switch (level) {
-        case LogLevel::DEBUG:   return "DEBUG";
-        case LogLevel::INFO:    return "INFO";
-        case LogLevel::WARNING: return "WARNING";
-        case LogLevel::ERROR:   return "ERROR";
-        case LogLevel::OFF:     return "OFF";
-        default:                break;
+    RotationWorker(const RotationWorker&) = delete;
+    RotationWorker& operator=(const RotationWorker&) = delete;
+
+    // Finishes the queued files first
+    ~RotationWorker() {
+        m_thread.request_stop();
+        m_thread.join();
+    }
+
+    void submit(std::string closed) {
+        {
+            const std::lock_guard lock(m_mutex);
+            m_pending.push_back(MOVE(closed));
         }
-        // clang-format on
-        return "UNKNOWN";
+        m_cv.notify_one();
     }
 
-    void write_log(const LogLevel level, const std::string_view message) const {
-        thread_local std::string buffer;
-        buffer.clear();
+private:
+    void run(const std::stop_token& token) {
+        std::unique_lock lock(m_mutex);
+        for (;;) {
+            m_cv.wait(lock, token, [this] { return !m_pending.empty(); });
+            if (m_pending.empty()) return;
 
-#ifdef LOG_COLOR
-        switch (level) {
-        case LogLevel::DEBUG:
-            buffer += debug_color;
-            break;
-        case LogLevel::INFO:
-            buffer += info_color;
-            break;
-        case LogLevel::WARNING:
-            buffer += warning_color;
-            break;
-        case LogLevel::ERROR:
-            buffer += error_color;
-            break;
-        default:
-            break;
+            const std::string closed = MOVE(m_pending.front());
+            m_pending.erase(m_pending.begin());
+            lock.unlock();
+            process(closed);
+            lock.lock();
         }
-#endif
+    }
 
-        buffer += std::format("[{}] {}", to_string(level), message);
-#ifdef LOG_COLOR
-        buffer += color::reset;
-#endif
+    [[nodiscard]] std::string rotated_path(const std::size_t index) const {
+        return std::format("{}.{}", m_path, index);
+    }
+
+    // Each index may hold a plain or a compressed file, e.g. from a run with other options
+    void move_rotated(const std::size_t from, const std::size_t to) const {
+        const std::string source = rotated_path(from);
+        const std::string target = rotated_path(to);
+        replace_file(source, target);
+        if (m_compressor) replace_file(source + m_compressor->suffix, target + m_compressor->suffix);
+    }
 
-        out() << buffer << '\n';
+    static void replace_file(const std::string& from, const std::string& to) noexcept {
+#ifdef _WIN32
+        std::remove(to.c_str());
+#endif // _WIN32
+        std::rename(from.c_str(), to.c_str());
     }
 
-    LogLevel m_level{LogLevel::INFO};
+    void process(const std::string& closed) const {
+        if (m_max_files == 0) {
+            std::remove(closed.c_str());
+            return;
+        }
 
-    std::string_view debug_color   = color::white;
-    std::string_view info_color    = color::cyan;
-    std::string_view warning_color = color::yellow;
-    std::string_view error_color   = color::red;
+        const std::string oldest = rotated_path(m_max_files);
+        std::remove(oldest.c_str());
+        if (m_compressor) std::remove((oldest + m_compressor->suffix).c_str());
+        for (std::size_t i = m_max_files; i > 1; --i) move_rotated(i - 1, i);
+
+        const std::string newest = rotated_path(1);
+        replace_file(closed, newest);
+        if (!m_compressor) return;
+        if (const auto result = m_compressor->compress(newest); !result) {
+            write_all(2, std::format("Could not compress '{}': {}\n", newest, result.error()));
+        }
+    }
+
+    const std::string m_path;
+    const std::size_t m_max_files;
+    const std::optional<Compressor> m_compressor;
+
+    std::mutex m_mutex;
+    std::condition_variable_any m_cv;
+    std::vector<std::string> m_pending;
+
+    std::jthread m_thread; // last so it starts after and stops before everything else
 };
 
 } // namespace detail
 
-} // namespace utils::log
+// Appends to path until the next write would exceed max_size or the file gets older than max_age,
+// then starts a new file. The writing thread only renames the file and swaps in a new descriptor,
+// a background thread shifts path.N-1 to path.N, ..., the closed file to path.1 and compresses it.
+// At most max_files rotated files are kept.
+class RotatingFileSink {
+public:
+    static std::expected<RotatingFileSink, std::string> open(std::string path, RotationOptions options) {
+        RotatingFileSink sink(MOVE(path), MOVE(options));
+        if (!sink.reopen()) return std::unexpected(detail::errno_message("Could not open log file", sink.m_path));
+        return sink;
+    }
 
-// these names are very common but works for me
+    static std::expected<RotatingFileSink, std::string> open(std::string path, const std::size_t max_size,
+                                                             const std::size_t max_files = 5) {
+        return open(MOVE(path), {.max_size = max_size, .max_files = max_files});
+    }
 
-#define DEBUG(fmt, ...) utils::log::detail::logger::instance().debug(fmt, __FILE__, __LINE__ __VA_OPT__(, ) __VA_ARGS__)
+    RotatingFileSink(const RotatingFileSink&) = delete;
+    RotatingFileSink& operator=(const RotatingFileSink&) = delete;
+    RotatingFileSink(RotatingFileSink&&) noexcept = default;
+    RotatingFileSink& operator=(RotatingFileSink&&) noexcept = default;
+    ~RotatingFileSink() = default;
 
-template <typename... Args>
-constexpr void INFO(const std::format_string<Args...> fmt, Args&&... args) {
-    utils::log::detail::logger::instance().log<utils::log::LogLevel::INFO>(fmt, FORWARD(args)...);
-}
+    [[nodiscard]] const std::string& path() const noexcept {
+        return m_path;
+    }
 
-template <typename... Args>
-constexpr void WARNING(const std::format_string<Args...> fmt, Args&&... args) {
-    utils::log::detail::logger::instance().log<utils::log::LogLevel::WARNING>(fmt, FORWARD(args)...);
-}
+    // The file currently written to
+    [[nodiscard]] int fd() const noexcept {
+        return m_file.fd();
+    }
 
-template <typename... Args>
-constexpr void ERROR(const std::format_string<Args...> fmt, Args&&... args) {
-    utils::log::detail::logger::instance().log<utils::log::LogLevel::ERROR>(fmt, FORWARD(args)...);
-}
+    void write(const std::string_view data) {
+        if (should_rotate(data.size())) rotate();
+        m_file.write(data);
+        m_size += data.size();
+    }
+
+    // The pieces are kept together in one file
+    void write_v(const std::span<const std::string_view> pieces) {
+        std::size_t size = 0;
+        for (const std::string_view piece : pieces) size += piece.size();
+        if (should_rotate(size)) rotate();
+        m_file.write_v(pieces);
+        m_size += size;
+    }
+
+    static void flush() noexcept {}
+
+private:
+    RotatingFileSink(std::string path, RotationOptions options)
+        : m_path(MOVE(path)), m_max_size(options.max_size), m_max_age(options.max_age), m_clock(MOVE(options.clock)),
+          m_worker(std::make_unique<detail::RotationWorker>(m_path, options.max_files, MOVE(options.compressor))) {}
+
+    [[nodiscard]] bool should_rotate(const std::size_t size) const {
+        if (m_size == 0) return false;
+        if (m_max_size > 0 && m_size + size > m_max_size) return true;
+        return m_max_age.count() > 0 && now() - m_opened >= m_max_age;
+    }
+
+    [[nodiscard]] std::chrono::steady_clock::time_point now() const {
+        return m_clock ? m_clock() : std::chrono::steady_clock::now();
+    }
+
+    // Opens the file before the old descriptor is closed, so there is always one to write to
+    bool reopen() {
+        const int fd = detail::open_for_append(m_path);
+        if (fd < 0) return false;
+        m_file = FdSink(fd, true);
+        m_opened = now();
+
+#ifdef _WIN32
+        const long long size = _lseeki64(fd, 0, SEEK_END);
+#else
+        const off_t size = ::lseek(fd, 0, SEEK_END);
+#endif // _WIN32
+        m_size = size > 0 ? static_cast<std::size_t>(size) : 0;
+        return true;
+    }
+
+    void rotate() {
+        // The pid keeps this apart from files left behind by an earlier process that did not finish
+        const std::string closed = std::format("{}.closing.{}.{}", m_path, detail::process_id(), m_rotations++);
+#ifdef _WIN32
+        m_file = FdSink(-1); // open files cannot be renamed
+#endif // _WIN32
+        if (std::rename(m_path.c_str(), closed.c_str()) == 0) {
+            if (reopen()) {
+                m_worker->submit(closed);
+                return;
+            }
+            std::rename(closed.c_str(), m_path.c_str());
+        }
+
+        // Keep writing to the current file and try again later
+        if (m_file.fd() < 0) reopen();
+        m_opened = now();
+    }
+
+    std::string m_path;
+    std::size_t m_max_size;
+    std::chrono::milliseconds m_max_age;
+    std::function<std::chrono::steady_clock::time_point()> m_clock;
+    std::size_t m_size = 0;
+    std::chrono::steady_clock::time_point m_opened;
+    u64 m_rotations = 0;
+    FdSink m_file{-1};
+    std::unique_ptr<detail::RotationWorker> m_worker; // destroyed first, finishes the queued files
+};
+
+// Keeps the most recent capacity bytes of output in memory. Copies share the same buffer,
+// so keep one around to read back what was logged after handing a copy to the logger.
+class RingSink {
+public:
+    explicit RingSink(const std::size_t capacity) : m_state(std::make_shared<State>(capacity)) {}
+
+    void write(const std::string_view data) const {
+        const std::lock_guard lock(m_state->mutex);
+        std::vector<char>& buffer = m_state->buffer;
+        if (buffer.empty()) return;
+
+        const std::string_view tail = data.size() > buffer.size() ? data.substr(data.size() - buffer.size()) : data;
+        // Remember the byte just before the oldest one kept, it tells whether that one starts a line
+        if (data.size() > buffer.size()) {
+            m_state->before_oldest = data[data.size() - buffer.size() - 1];
+        } else if (m_state->written + data.size() > buffer.size()) {
+            m_state->before_oldest = buffer[(m_state->written + data.size() - 1) % buffer.size()];
+        }
+
+        // Only the tail is stored, but written counts every byte, so it lands where it would have
+        std::size_t pos = (m_state->written + data.size() - tail.size()) % buffer.size();
+        for (const char c : tail) {
+            buffer[pos] = c;
+            if (++pos == buffer.size()) pos = 0;
+        }
+        m_state->written += data.size();
+    }
+
+    static void flush() noexcept {}
+
+    // Oldest to newest, starting at the first complete line once the ring has wrapped
+    [[nodiscard]] std::string contents() const {
+        const std::lock_guard lock(m_state->mutex);
+        const std::vector<char>& buffer = m_state->buffer;
+        if (m_state->written <= buffer.size()) return {buffer.data(), m_state->written};
+
+        const std::size_t pos = m_state->written % buffer.size();
+        std::string result(buffer.data() + pos, buffer.size() - pos);
+        result.append(buffer.data(), pos);
+        if (m_state->before_oldest == '\n') return result;
+        if (const std::size_t newline = result.find('\n'); newline != std::string::npos) result.erase(0, newline + 1);
+        return result;
+    }
+
+    void clear() const {
+        const std::lock_guard lock(m_state->mutex);
+        m_state->written = 0;
+    }
+
+private:
+    struct State {
+        explicit State(const std::size_t capacity) : buffer(capacity) {}
+
+        std::mutex mutex;
+        std::vector<char> buffer;
+        std::size_t written = 0;
+        char before_oldest = '\0';
+    };
+
+    std::shared_ptr<State> m_state;
+};
+
+// Writes every line to all of the given sinks, dispatched at compile time
+template <Sink... Sinks>
+class SinkList {
+public:
+    explicit SinkList(Sinks... sinks) : m_sinks(MOVE(sinks)...) {}
+
+    void write(const std::string_view data) {
+        std::apply([&](auto&... sinks) { (sinks.write(data), ...); }, m_sinks);
+    }
+
+    void write_v(const std::span<const std::string_view> pieces) {
+        std::apply([&](auto&... sinks) { (detail::write_pieces(sinks, pieces), ...); }, m_sinks);
+    }
+
+    void flush() {
+        std::apply([](auto&... sinks) { (sinks.flush(), ...); }, m_sinks);
+    }
+
+    template <std::size_t I>
+    auto& get() noexcept {
+        return std::get<I>(m_sinks);
+    }
+
+private:
+    std::tuple<Sinks...> m_sinks;
+};
+
+// Binary log file in a memory mapping that grows in chunks. Only the backend thread writes to
+// it, so async records are appended with a memcpy and no system call except when growing.
+// Use decode_binary or the log_decode tool to turn the file into text.
+class BinaryFileSink {
+public:
+    static constexpr std::size_t default_chunk_size = std::size_t{16} << 20;
+    static constexpr std::string_view magic = "ULOGBIN1";
+    static constexpr u32 version = 1;
+
+    static std::expected<BinaryFileSink, std::string> open(const std::string& path,
+                                                           const std::size_t chunk_size = default_chunk_size) {
+#ifdef _WIN32
+        UNUSED(chunk_size);
+        return std::unexpected(std::format("Could not open binary log file '{}': not supported on Windows", path));
+#else
+        BinaryFileSink sink(::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644),
+                            chunk_size < 4096 ? 4096 : chunk_size);
+        if (sink.m_fd < 0 || !sink.grow(0)) {
+            return std::unexpected(detail::errno_message("Could not open binary log file", path));
+        }
+
+        std::byte* header = sink.reserve(magic.size() + sizeof(version));
+        std::memcpy(header, magic.data(), magic.size());
+        std::memcpy(header + magic.size(), &version, sizeof(version));
+        sink.commit(magic.size() + sizeof(version));
+        return sink;
+#endif // _WIN32
+    }
+
+    BinaryFileSink(const BinaryFileSink&) = delete;
+    BinaryFileSink& operator=(const BinaryFileSink&) = delete;
+
+    BinaryFileSink(BinaryFileSink&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1)), m_chunk_size(other.m_chunk_size),
+          m_data(std::exchange(other.m_data, nullptr)), m_size(std::exchange(other.m_size, 0)),
+          m_capacity(std::exchange(other.m_capacity, 0)) {}
+
+    BinaryFileSink& operator=(BinaryFileSink&& other) noexcept {
+        if (this != &other) {
+            close();
+            m_fd = std::exchange(other.m_fd, -1);
+            m_chunk_size = other.m_chunk_size;
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+            m_capacity = std::exchange(other.m_capacity, 0);
+        }
+        return *this;
+    }
+
+    ~BinaryFileSink() {
+        close();
+    }
+
+    // Bytes written so far, including the file header
+    [[nodiscard]] std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    // Space for size more bytes, nullptr if the file could not grow
+    std::byte* reserve(const std::size_t size) {
+        if (m_size + size > m_capacity && !grow(size)) return nullptr;
+        return m_data + m_size;
+    }
+
+    void commit(const std::size_t size) noexcept {
+        m_size += size;
+    }
+
+    // Asks the kernel to start writing dirty pages back, does not wait for it
+    void flush() const noexcept {
+#ifndef _WIN32
+        if (m_data != nullptr) ::msync(m_data, m_capacity, MS_ASYNC);
+#endif // _WIN32
+    }
+
+    // Unmaps and truncates the file to the bytes actually written
+    void close() noexcept {
+#ifndef _WIN32
+        if (m_data != nullptr) ::munmap(m_data, m_capacity);
+        if (m_fd >= 0) {
+            UNUSED(::ftruncate(m_fd, static_cast<off_t>(m_size)));
+            ::close(m_fd);
+        }
+#endif // _WIN32
+        m_data = nullptr;
+        m_fd = -1;
+        m_size = 0;
+        m_capacity = 0;
+    }
+
+private:
+    BinaryFileSink(const int fd, const std::size_t chunk_size) noexcept : m_fd(fd), m_chunk_size(chunk_size) {}
+
+    bool grow(const std::size_t needed) {
+#ifdef _WIN32
+        UNUSED(needed);
+        return false;
+#else
+        std::size_t capacity = m_capacity + m_chunk_size;
+        while (capacity < m_size + needed) capacity += m_chunk_size;
+        if (::ftruncate(m_fd, static_cast<off_t>(capacity)) != 0) return false;
+
+        void* data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (data == MAP_FAILED) return false;
+        if (m_data != nullptr) ::munmap(m_data, m_capacity);
+
+        m_data = static_cast<std::byte*>(data);
+        m_capacity = capacity;
+        return true;
+#endif // _WIN32
+    }
+
+    int m_fd;
+    std::size_t m_chunk_size;
+    std::byte* m_data = nullptr;
+    std::size_t m_size = 0;
+    std::size_t m_capacity = 0;
+};
+
+namespace detail {
+class logger;
+} // namespace detail
+
+// A named subsystem with its own runtime level. Categories are never destroyed, so call sites
+// keep a reference in a static and the level check is a single relaxed load.
+class Category {
+public:
+    Category(std::string name, const LogLevel level) : m_name(MOVE(name)), m_level(level) {}
+
+    Category(const Category&) = delete;
+    Category& operator=(const Category&) = delete;
+
+    [[nodiscard]] std::string_view name() const noexcept {
+        return m_name;
+    }
+
+    [[nodiscard]] LogLevel level() const noexcept {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool enabled(const LogLevel level) const noexcept {
+        return level >= this->level();
+    }
+
+private:
+    friend class detail::logger;
+
+    const std::string m_name;
+    std::atomic<LogLevel> m_level;
+    bool m_explicit = false; // guarded by the logger's category mutex
+};
+
+namespace color {
+
+// clang-format off
+inline constexpr std::string_view black   = "\033[30m";
+inline constexpr std::string_view red     = "\033[31m";
+inline constexpr std::string_view green   = "\033[32m";
+inline constexpr std::string_view yellow  = "\033[33m";
+inline constexpr std::string_view blue    = "\033[34m";
+inline constexpr std::string_view magenta = "\033[35m";
+inline constexpr std::string_view cyan    = "\033[36m";
+inline constexpr std::string_view white   = "\033[37m";
+
+inline constexpr std::string_view reset   = "\033[0m";
+// clang-format on
+
+} // namespace color
+
+namespace detail {
+
+constexpr std::size_t round_up_pow2(std::size_t n) noexcept {
+    std::size_t result = 1;
+    while (result < n) result <<= 1;
+    return result;
+}
+
+// Bounded lock-free single-producer single-consumer queue of variable sized records.
+// Every record is prefixed with its size and padded to 8 bytes, a zero size marks
+// the unused tail of the buffer when a record had to wrap around to the front.
+class SpscQueue {
+public:
+    static constexpr std::size_t header_size = 8;
+
+    explicit SpscQueue(const std::size_t capacity)
+        : m_capacity(round_up_pow2(capacity < 64 ? 64 : capacity)),
+          m_buffer(std::make_unique<std::byte[]>(m_capacity)) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    [[nodiscard]] std::size_t capacity() const noexcept {
+        return m_capacity;
+    }
+
+    // Whether a record with the given payload size can ever fit into this queue
+    [[nodiscard]] bool fits(const std::size_t size) const noexcept {
+        return record_size(size) <= m_capacity;
+    }
+
+    // Producer side, returns nullptr when there is currently not enough space. A record that does
+    // not fit before the end of the buffer is preceded by padding up to the end, which is published
+    // on its own as soon as the consumer has read past it, so a record only ever waits for its own
+    // size to become free and any record that fits() is eventually written.
+    std::byte* prepare_write(const std::size_t size) noexcept {
+        const std::size_t needed = record_size(size);
+        std::size_t offset = m_write_local & (m_capacity - 1);
+        const std::size_t contiguous = m_capacity - offset;
+
+        if (needed > contiguous) {
+            if (!has_space(contiguous)) return nullptr;
+            store_size(offset, 0);
+            m_write_local += contiguous;
+            m_write.store(m_write_local, std::memory_order_release);
+            offset = 0;
+        }
+        if (!has_space(needed)) return nullptr;
+
+        store_size(offset, static_cast<u32>(needed));
+        m_pending = needed;
+        return m_buffer.get() + offset + header_size;
+    }
+
+    void commit_write() noexcept {
+        m_write_local += m_pending;
+        m_write.store(m_write_local, std::memory_order_release);
+    }
+
+    // Consumer side, returns nullptr when the queue is empty
+    const std::byte* front() noexcept {
+        for (;;) {
+            if (m_read_local == m_write_cache) {
+                m_write_cache = m_write.load(std::memory_order_acquire);
+                if (m_read_local == m_write_cache) return nullptr;
+            }
+
+            const std::size_t offset = m_read_local & (m_capacity - 1);
+            const u32 size = load_size(offset);
+            if (size != 0) {
+                m_front_size = size;
+                return m_buffer.get() + offset + header_size;
+            }
+
+            // Padding, handed back right away as the record after it may be waiting for the space
+            m_read_local += m_capacity - offset;
+            m_read.store(m_read_local, std::memory_order_release);
+        }
+    }
+
+    void pop() noexcept {
+        m_read_local += m_front_size;
+        m_read.store(m_read_local, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return m_read.load(std::memory_order_acquire) == m_write.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr std::size_t record_size(const std::size_t size) noexcept {
+        return (header_size + size + 7) & ~std::size_t{7};
+    }
+
+    [[nodiscard]] bool has_space(const std::size_t size) noexcept {
+        if (m_write_local + size - m_read_cache <= m_capacity) return true;
+        m_read_cache = m_read.load(std::memory_order_acquire);
+        return m_write_local + size - m_read_cache <= m_capacity;
+    }
+
+    void store_size(const std::size_t offset, const u32 size) noexcept {
+        std::memcpy(m_buffer.get() + offset, &size, sizeof(size));
+    }
+
+    [[nodiscard]] u32 load_size(const std::size_t offset) const noexcept {
+        u32 size;
+        std::memcpy(&size, m_buffer.get() + offset, sizeof(size));
+        return size;
+    }
+
+    const std::size_t m_capacity;
+    std::unique_ptr<std::byte[]> m_buffer;
+
+    // Producer owned
+    alignas(64) std::atomic<std::size_t> m_write{0};
+    std::size_t m_write_local = 0;
+    std::size_t m_read_cache = 0;
+    std::size_t m_pending = 0;
+
+    // Consumer owned
+    alignas(64) std::atomic<std::size_t> m_read{0};
+    std::size_t m_read_local = 0;
+    std::size_t m_write_cache = 0;
+    std::size_t m_front_size = 0;
+};
+
+// Only the standard string types are copied as text, anything else that merely converts to a
+// string_view may have its own formatter and is formatted like any other type
+template <typename T>
+concept string_like = std::same_as<std::decay_t<T>, std::string> || std::same_as<std::decay_t<T>, std::string_view> ||
+                      std::same_as<std::decay_t<T>, const char*> || std::same_as<std::decay_t<T>, char*>;
+
+// Serializes a single argument into a record and reads it back on the backend thread
+template <typename T>
+struct ArgCodec {
+    static_assert(std::is_trivially_copyable_v<T>, "is_deferrable types must be trivially copyable");
+    using value_type = T;
+
+    static std::size_t size(const T&) noexcept {
+        return sizeof(T);
+    }
+
+    static std::byte* encode(std::byte* dest, const T& value) noexcept {
+        std::memcpy(dest, &value, sizeof(T));
+        return dest + sizeof(T);
+    }
+
+    static T decode(const std::byte*& src) noexcept {
+        T value;
+        std::memcpy(&value, src, sizeof(T));
+        src += sizeof(T);
+        return value;
+    }
+};
+
+template <string_like T>
+struct ArgCodec<T> {
+    using value_type = std::string_view;
+
+    static std::size_t size(const std::string_view value) noexcept {
+        return sizeof(std::size_t) + value.size();
+    }
+
+    static std::byte* encode(std::byte* dest, const std::string_view value) noexcept {
+        const std::size_t size = value.size();
+        std::memcpy(dest, &size, sizeof(size));
+        std::memcpy(dest + sizeof(size), value.data(), size);
+        return dest + sizeof(size) + size;
+    }
+
+    static std::string_view decode(const std::byte*& src) noexcept {
+        std::size_t size;
+        std::memcpy(&size, src, sizeof(size));
+        const std::string_view value(reinterpret_cast<const char*>(src + sizeof(size)), size);
+        src += sizeof(size) + size;
+        return value;
+    }
+};
+
+template <typename T>
+using codec_t = ArgCodec<std::decay_t<T>>;
+
+template <typename T>
+consteval bool deferrable() {
+    using D = std::decay_t<T>;
+    return string_like<D> || is_deferrable<D>::value;
+}
+
+// Type tags describing encoded arguments, written to binary log files for the offline decoder.
+// Custom is followed by the u32 size of the type.
+enum class ArgType : u8 {
+    Bool = 1, Char, I8, I16, I32, I64, U8, U16, U32, U64, F32, F64, LongDouble, String, Pointer, Null, Custom,
+};
+
+template <typename T>
+consteval ArgType arg_type() {
+    using D = std::decay_t<T>;
+    if constexpr (string_like<D>) return ArgType::String;
+    else if constexpr (std::is_same_v<D, bool>) return ArgType::Bool;
+    else if constexpr (std::is_same_v<D, char>) return ArgType::Char;
+    else if constexpr (std::is_integral_v<D> && std::is_signed_v<D>) {
+        constexpr std::array types = {ArgType::I8, ArgType::I16, ArgType::I32, ArgType::I64};
+        return types[std::bit_width(sizeof(D)) - 1];
+    } else if constexpr (std::is_integral_v<D>) {
+        constexpr std::array types = {ArgType::U8, ArgType::U16, ArgType::U32, ArgType::U64};
+        return types[std::bit_width(sizeof(D)) - 1];
+    } else if constexpr (std::is_same_v<D, float>) return ArgType::F32;
+    else if constexpr (std::is_same_v<D, double>) return ArgType::F64;
+    else if constexpr (std::is_same_v<D, long double>) return ArgType::LongDouble;
+    else if constexpr (std::is_same_v<D, std::nullptr_t>) return ArgType::Null;
+    else if constexpr (std::is_pointer_v<D>) return ArgType::Pointer;
+    else return ArgType::Custom;
+}
+
+template <typename... Args>
+consteval auto make_arg_types() {
+    constexpr std::size_t size = (std::size_t{0} + ... + (arg_type<Args>() == ArgType::Custom ? 5 : 1));
+    std::array<u8, size> result{};
+    std::size_t pos = 0;
+    const auto append = [&]<typename T>() {
+        result[pos++] = static_cast<u8>(arg_type<T>());
+        if constexpr (arg_type<T>() == ArgType::Custom) {
+            for (std::size_t i = 0; i < 4; ++i) result[pos++] = static_cast<u8>(sizeof(std::decay_t<T>) >> (8 * i));
+        }
+    };
+    (append.template operator()<Args>(), ...);
+    UNUSED(append);
+    return result;
+}
+
+template <typename... Args>
+inline constexpr auto arg_types = make_arg_types<Args...>();
+
+// Appends the formatted message of a deferred record, instantiated once per argument type list
+using FormatFn = void (*)(std::string& out, std::string_view fmt, const std::byte* args);
+
+template <typename... Args>
+void format_deferred(std::string& out, const std::string_view fmt, const std::byte* args) {
+    UNUSED(args);
+    // Braced initialization guarantees the arguments are decoded left to right
+    std::tuple<typename codec_t<Args>::value_type...> values{codec_t<Args>::decode(args)...};
+    std::apply(
+        [&](auto&... decoded) { std::vformat_to(std::back_inserter(out), fmt, std::make_format_args(decoded...)); },
+        values);
+}
+
+struct DeferredInfo {
+    FormatFn format;
+    std::span<const u8> arg_types;
+};
+
+template <typename... Args>
+inline constexpr DeferredInfo deferred_info{&format_deferred<Args...>, arg_types<Args...>};
+
+// Wall clock built on a cheap tick counter (the TSC on x86, the virtual counter on ARM64),
+// calibrated against std::chrono::system_clock. Whichever thread first notices that a second
+// has passed since the last sync re-anchors it, which also picks up wall clock adjustments.
+class FastClock {
+public:
+    static FastClock& instance() {
+        static FastClock clock;
+        return clock;
+    }
+
+    FastClock(const FastClock&) = delete;
+    FastClock& operator=(const FastClock&) = delete;
+
+    static u64 ticks() noexcept {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        u64 value;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+        return value;
+#else
+        return static_cast<u64>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    // Nanoseconds since the epoch
+    i64 now() noexcept {
+        const u64 now_ticks = ticks();
+        const Anchor anchor = load();
+        const i64 elapsed = anchor.elapsed(now_ticks);
+        if (elapsed >= ns_per_second && resync()) return to_ns(now_ticks);
+        return anchor.ns + elapsed;
+    }
+
+    // Converts a recent value of ticks() without resyncing
+    [[nodiscard]] i64 to_ns(const u64 ticks) const noexcept {
+        const Anchor anchor = load();
+        return anchor.ns + anchor.elapsed(ticks);
+    }
+
+private:
+    static constexpr i64 ns_per_second = 1'000'000'000;
+
+    struct Anchor {
+        u64 ticks;
+        i64 ns;
+        double rate; // nanoseconds per tick
+
+        [[nodiscard]] i64 elapsed(const u64 now) const noexcept {
+            return static_cast<i64>(static_cast<double>(static_cast<i64>(now - ticks)) * rate);
+        }
+    };
+
+    FastClock() {
+        m_origin = sample();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        const Anchor anchor = sample();
+        store({anchor.ticks, anchor.ns, rate_since_origin(anchor)});
+    }
+
+    // Reads the counter on both sides of the system clock and keeps the tightest of a few tries
+    static Anchor sample() noexcept {
+        Anchor best{};
+        u64 best_gap = ~u64{0};
+        for (int i = 0; i < 5; ++i) {
+            const u64 before = ticks();
+            const i64 ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::system_clock::now().time_since_epoch())
+                               .count();
+            const u64 after = ticks();
+            if (after - before < best_gap) {
+                best_gap = after - before;
+                best = {before + (after - before) / 2, ns, 0.0};
+            }
+        }
+        return best;
+    }
+
+    [[nodiscard]] double rate_since_origin(const Anchor& anchor) const noexcept {
+        const auto ticks = static_cast<double>(static_cast<i64>(anchor.ticks - m_origin.ticks));
+        if (ticks <= 0.0) return 1.0;
+        return static_cast<double>(anchor.ns - m_origin.ns) / ticks;
+    }
+
+    // Seqlock read, writers bump m_sequence to odd before and to even after updating the anchor
+    Anchor load() const noexcept {
+        for (;;) {
+            const u64 sequence = m_sequence.load(std::memory_order_acquire);
+            const Anchor anchor{m_ticks.load(std::memory_order_relaxed), m_ns.load(std::memory_order_relaxed),
+                                m_rate.load(std::memory_order_relaxed)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((sequence & 1) == 0 && m_sequence.load(std::memory_order_relaxed) == sequence) return anchor;
+        }
+    }
+
+    void store(const Anchor& anchor) noexcept {
+        m_ticks.store(anchor.ticks, std::memory_order_relaxed);
+        m_ns.store(anchor.ns, std::memory_order_relaxed);
+        m_rate.store(anchor.rate, std::memory_order_relaxed);
+    }
+
+    // Returns false when another thread is already resyncing
+    bool resync() noexcept {
+        u64 sequence = m_sequence.load(std::memory_order_relaxed);
+        if ((sequence & 1) != 0 ||
+            !m_sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        const Anchor anchor = sample();
+        const double current = m_rate.load(std::memory_order_relaxed);
+        double rate = rate_since_origin(anchor);
+        // A rate far from the current one means the wall clock was stepped, measure again from here
+        if (rate < current * 0.99 || rate > current * 1.01) {
+            rate = current;
+            m_origin = anchor;
+        }
+        store({anchor.ticks, anchor.ns, rate});
+
+        m_sequence.store(sequence + 2, std::memory_order_release);
+        return true;
+    }
+
+    Anchor m_origin{}; // first sample, only touched under the seqlock
+
+    std::atomic<u64> m_sequence{0};
+    std::atomic<u64> m_ticks{0};
+    std::atomic<i64> m_ns{0};
+    std::atomic<double> m_rate{1.0};
+};
+
+// Fixed part of every record pushed to a producer queue. It is followed by the formatted
+// message when deferred is null, otherwise by the arguments encoded for deferred->format.
+struct RecordHeader {
+    LogLevel level{};
+    u32 line = 0;
+    const char* file = nullptr;
+    std::size_t file_size = 0;
+    std::size_t message_size = 0;
+    const DeferredInfo* deferred = nullptr;
+    const char* fmt = nullptr;
+    std::size_t fmt_size = 0;
+    const Category* category = nullptr;
+    i64 timestamp = 0; // nanoseconds since the epoch, set in async mode or when timestamps are enabled
+    bool structured = false; // the message is a complete key-value line without the newline
+};
+
+// A producer thread's chain of queues. The producer appends a bigger queue when it grows,
+// the backend follows the chain and frees each queue once it is fully drained.
+struct ProducerContext {
+    struct Node {
+        explicit Node(const std::size_t capacity) : queue(capacity) {}
+
+        SpscQueue queue;
+        std::atomic<Node*> next{nullptr};
+    };
+
+    explicit ProducerContext(const std::size_t capacity) : head(new Node(capacity)), tail(head) {}
+
+    ProducerContext(const ProducerContext&) = delete;
+    ProducerContext& operator=(const ProducerContext&) = delete;
+
+    ~ProducerContext() {
+        while (head != nullptr) {
+            Node* next = head->next.load(std::memory_order_acquire);
+            delete head;
+            head = next;
+        }
+    }
+
+    // Backend side, true once the producer thread exited and everything it pushed was consumed
+    [[nodiscard]] bool finished() const noexcept {
+        return closed.load(std::memory_order_acquire) && head->next.load(std::memory_order_acquire) == nullptr &&
+               head->queue.empty();
+    }
+
+    Node* head; // backend owned
+    Node* tail; // producer owned
+    std::atomic<bool> closed{false};
+};
+
+// Owns the configured sink behind two plain function pointers, the sink's own write is
+// fully inlined into them so a SinkList of any size costs a single indirect call
+class AnySink {
+public:
+    template <Sink S>
+    explicit AnySink(S sink)
+        : m_sink(new S(MOVE(sink))),
+          m_write([](void* s, const std::string_view data) { static_cast<S*>(s)->write(data); }),
+          m_write_v([](void* s, const std::span<const std::string_view> pieces) {
+              write_pieces(*static_cast<S*>(s), pieces);
+          }),
+          m_flush([](void* s) { static_cast<S*>(s)->flush(); }),
+          m_fd([](const void* s) -> int {
+              if constexpr (requires(const S& sink) { { sink.fd() } -> std::convertible_to<int>; }) {
+                  return static_cast<const S*>(s)->fd();
+              } else {
+                  UNUSED(s);
+                  return -1;
+              }
+          }),
+          m_destroy([](void* s) { delete static_cast<S*>(s); }) {}
+
+    AnySink(const AnySink&) = delete;
+    AnySink& operator=(const AnySink&) = delete;
+
+    AnySink(AnySink&& other) noexcept
+        : m_sink(std::exchange(other.m_sink, nullptr)), m_write(other.m_write), m_write_v(other.m_write_v),
+          m_flush(other.m_flush), m_fd(other.m_fd), m_destroy(other.m_destroy) {}
+
+    AnySink& operator=(AnySink&& other) noexcept {
+        if (this != &other) {
+            if (m_sink != nullptr) m_destroy(m_sink);
+            m_sink = std::exchange(other.m_sink, nullptr);
+            m_write = other.m_write;
+            m_write_v = other.m_write_v;
+            m_flush = other.m_flush;
+            m_fd = other.m_fd;
+            m_destroy = other.m_destroy;
+        }
+        return *this;
+    }
+
+    ~AnySink() {
+        if (m_sink != nullptr) m_destroy(m_sink);
+    }
+
+    void write(const std::string_view data) const {
+        m_write(m_sink, data);
+    }
+
+    void write_v(const std::span<const std::string_view> pieces) const {
+        m_write_v(m_sink, pieces);
+    }
+
+    void flush() const {
+        m_flush(m_sink);
+    }
+
+    // The descriptor the sink writes to, -1 when it does not have a single one
+    [[nodiscard]] int fd() const noexcept {
+        return m_fd(m_sink);
+    }
+
+private:
+    void* m_sink;
+    void (*m_write)(void*, std::string_view);
+    void (*m_write_v)(void*, std::span<const std::string_view>);
+    void (*m_flush)(void*);
+    int (*m_fd)(const void*);
+    void (*m_destroy)(void*);
+};
+
+// Collects lines in fixed size blocks that are handed to the sink as one vectored write.
+// Blocks keep their capacity between flushes.
+class CoalescingWriter {
+public:
+    static constexpr std::size_t block_size = std::size_t{64} << 10;
+
+    void append(const std::string_view data) {
+        if (m_used == 0 || m_blocks[m_used - 1].size() + data.size() > m_blocks[m_used - 1].capacity()) {
+            if (m_used == m_blocks.size()) m_blocks.emplace_back().reserve(block_size);
+            m_blocks[m_used].reserve(data.size());
+            ++m_used;
+        }
+        m_blocks[m_used - 1] += data;
+        m_size += data.size();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    void write_to(const AnySink& sink) {
+        if (m_size == 0) return;
+        m_pieces.assign(m_blocks.begin(), m_blocks.begin() + static_cast<std::ptrdiff_t>(m_used));
+        sink.write_v(m_pieces);
+        for (std::size_t i = 0; i < m_used; ++i) m_blocks[i].clear();
+        m_used = 0;
+        m_size = 0;
+    }
+
+    // Writes the blocks straight to fd without allocating, for signal handlers
+    void write_to_fd(const int fd) noexcept {
+        for (std::size_t i = 0; i < m_used; ++i) {
+            write_all(fd, m_blocks[i]);
+            m_blocks[i].clear();
+        }
+        m_used = 0;
+        m_size = 0;
+    }
+
+private:
+    std::vector<std::string> m_blocks;
+    std::vector<std::string_view> m_pieces;
+    std::size_t m_used = 0;
+    std::size_t m_size = 0;
+};
+
+// Key-value encoders, both escape while copying and write straight into the line buffer
+
+constexpr bool needs_escape(const unsigned char c) noexcept {
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+// Runs of characters that are not special are appended in one go, handle writes the others
+template <typename Special, typename Handle>
+void append_escaped(std::string& out, const std::string_view value, Special&& special, Handle&& handle) {
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < value.size(); ++i) {
+        const auto c = static_cast<unsigned char>(value[i]);
+        if (!special(c)) continue;
+        out.append(value.data() + start, i - start);
+        handle(c);
+        start = i + 1;
+    }
+    out.append(value.data() + start, value.size() - start);
+}
+
+inline void append_escape_sequence(std::string& out, const unsigned char c) {
+    switch (c) {
+    case '"':
+        out += "\\\"";
+        break;
+    case '\\':
+        out += "\\\\";
+        break;
+    case '\n':
+        out += "\\n";
+        break;
+    case '\r':
+        out += "\\r";
+        break;
+    case '\t':
+        out += "\\t";
+        break;
+    default: {
+        constexpr std::string_view hex = "0123456789abcdef";
+        out += "\\u00";
+        out += hex[c >> 4];
+        out += hex[c & 0xf];
+        break;
+    }
+    }
+}
+
+template <typename T>
+void append_number(std::string& out, const T value) {
+    std::array<char, 64> buffer; // NOLINT(cppcoreguidelines-pro-type-member-init)
+    const auto result = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+    out.append(buffer.data(), result.ptr);
+}
+
+struct JsonEncoder {
+    static void begin(std::string& out) {
+        out += '{';
+    }
+
+    static void key(std::string& out, const std::string_view key, const bool first) {
+        if (!first) out += ',';
+        string(out, key);
+        out += ':';
+    }
+
+    static void string(std::string& out, const std::string_view value) {
+        out += '"';
+        append_escaped(out, value, needs_escape, [&out](const unsigned char c) { append_escape_sequence(out, c); });
+        out += '"';
+    }
+
+    template <typename T>
+    static void number(std::string& out, const T value) {
+        if constexpr (std::is_floating_point_v<T>) {
+            if (!std::isfinite(value)) {
+                out += "null";
+                return;
+            }
+        }
+        append_number(out, value);
+    }
+
+    static void boolean(std::string& out, const bool value) {
+        out += value ? "true" : "false";
+    }
+
+    static void null(std::string& out) {
+        out += "null";
+    }
+
+    static void end(std::string& out) {
+        out += '}';
+    }
+};
+
+// Keys and values are quoted only when they are empty or contain a space, '=', a quote or a control character
+struct LogfmtEncoder {
+    static void begin(std::string&) {}
+
+    static void key(std::string& out, const std::string_view key, const bool first) {
+        if (!first) out += ' ';
+        string(out, key);
+        out += '=';
+    }
+
+    static void string(std::string& out, const std::string_view value) {
+        const std::size_t start = out.size();
+        bool quote = value.empty();
+        append_escaped(
+            out, value, [](const unsigned char c) { return c == ' ' || c == '=' || needs_escape(c); },
+            [&](const unsigned char c) {
+                if (c == ' ' || c == '=') {
+                    out += static_cast<char>(c);
+                } else {
+                    append_escape_sequence(out, c);
+                }
+                quote = true;
+            });
+        if (!quote) return;
+        out.insert(start, 1, '"');
+        out += '"';
+    }
+
+    template <typename T>
+    static void number(std::string& out, const T value) {
+        append_number(out, value);
+    }
+
+    static void boolean(std::string& out, const bool value) {
+        out += value ? "true" : "false";
+    }
+
+    static void null(std::string& out) {
+        out += "null";
+    }
+
+    static void end(std::string&) {}
+};
+
+template <typename Encoder, typename T>
+void append_kv_value(std::string& out, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        Encoder::boolean(out, value);
+    } else if constexpr (std::is_same_v<T, char>) {
+        Encoder::string(out, std::string_view(&value, 1));
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        Encoder::number(out, value);
+    } else if constexpr (std::is_null_pointer_v<T>) {
+        Encoder::null(out);
+    } else if constexpr (string_like<T>) {
+        Encoder::string(out, std::string_view(value));
+    } else {
+        // Anything else goes through its formatter into a reused buffer first
+        thread_local std::string formatted;
+        formatted.clear();
+        std::format_to(std::back_inserter(formatted), "{}", value);
+        Encoder::string(out, formatted);
+    }
+}
+
+template <typename Encoder>
+void append_kv_fields(std::string&) {}
+
+template <typename Encoder, typename Key, typename Value, typename... Rest>
+void append_kv_fields(std::string& out, const Key& key, const Value& value, const Rest&... rest) {
+    static_assert(string_like<Key>, "keys of a key-value log call must be strings");
+    Encoder::key(out, std::string_view(key), false);
+    append_kv_value<Encoder>(out, value);
+    append_kv_fields<Encoder>(out, rest...);
+}
+
+constexpr std::string_view to_string(const LogLevel level) {
+    // clang-format off
+    switch (level) {
+    case LogLevel::DEBUG:   return "DEBUG";
+    case LogLevel::INFO:    return "INFO";
+    case LogLevel::WARNING: return "WARNING";
+    case LogLevel::ERROR:   return "ERROR";
+    case LogLevel::OFF:     return "OFF";
+    default:                break;
+    }
+    // clang-format on
+    return "UNKNOWN";
+}
+
+// Days since 1970-01-01 to a civil date, from https://howardhinnant.github.io/date_algorithms.html
+constexpr void civil_from_days(i64 days, i64& year, u32& month, u32& day) noexcept {
+    days += 719468;
+    const i64 era = (days >= 0 ? days : days - 146096) / 146097;
+    const auto doe = static_cast<u32>(days - era * 146097);
+    const u32 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const u32 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const u32 mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = static_cast<i64>(yoe) + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+// Appends "YYYY-MM-DD HH:MM:SS" followed by '.' and the given number of fractional digits
+inline void append_timestamp(std::string& out, const i64 ns, const int digits) {
+    constexpr i64 ns_per_second = 1'000'000'000;
+    constexpr i64 seconds_per_day = 86400;
+
+    const i64 seconds = ns >= 0 ? ns / ns_per_second : (ns - ns_per_second + 1) / ns_per_second;
+    const i64 days = seconds >= 0 ? seconds / seconds_per_day : (seconds - seconds_per_day + 1) / seconds_per_day;
+    const i64 second_of_day = seconds - days * seconds_per_day;
+
+    i64 year;
+    u32 month;
+    u32 day;
+    civil_from_days(days, year, month, day);
+    std::format_to(std::back_inserter(out), "{:04}-{:02}-{:02} {:02}:{:02}:{:02}", year, month, day,
+                   second_of_day / 3600, second_of_day / 60 % 60, second_of_day % 60);
+
+    if (digits > 0) {
+        i64 fraction = ns - seconds * ns_per_second;
+        for (int i = digits; i < 9; ++i) fraction /= 10;
+        std::format_to(std::back_inserter(out), ".{:0{}}", fraction, digits);
+    }
+}
+
+constexpr int timestamp_digits(const TimestampPrecision precision) noexcept {
+    switch (precision) {
+    case TimestampPrecision::Milliseconds:
+        return 3;
+    case TimestampPrecision::Microseconds:
+        return 6;
+    case TimestampPrecision::Nanoseconds:
+        return 9;
+    default:
+        return 0;
+    }
+}
+
+// Same output as append_timestamp, but the date and time are only formatted again when the
+// second changes, otherwise just the fractional digits are written
+class TimestampCache {
+public:
+    void append(std::string& out, const i64 ns, const int digits) {
+        constexpr i64 ns_per_second = 1'000'000'000;
+
+        const i64 second = ns >= 0 ? ns / ns_per_second : (ns - ns_per_second + 1) / ns_per_second;
+        if (m_prefix.empty() || second != m_second) {
+            m_prefix.clear();
+            append_timestamp(m_prefix, second * ns_per_second, 0);
+            m_second = second;
+        }
+        out += m_prefix;
+        if (digits <= 0) return;
+
+        i64 fraction = ns - second * ns_per_second;
+        for (int i = digits; i < 9; ++i) fraction /= 10;
+        std::array<char, 10> buffer{'.'};
+        for (int i = digits; i > 0; --i) {
+            buffer[static_cast<std::size_t>(i)] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        out.append(buffer.data(), static_cast<std::size_t>(digits) + 1);
+    }
+
+private:
+    i64 m_second = 0;
+    std::string m_prefix;
+};
+
+// One key-value line without the newline: ts (when enabled), level, caller (DEBUG only), msg, fields
+template <typename Encoder, typename... Fields>
+void encode_kv(std::string& out, const RecordHeader& header, const TimestampPrecision precision,
+               const std::string_view message, const Fields&... fields) {
+    thread_local std::string scratch;
+    Encoder::begin(out);
+    if (precision != TimestampPrecision::None) {
+        thread_local TimestampCache cache;
+        scratch.clear();
+        cache.append(scratch, header.timestamp, timestamp_digits(precision));
+        Encoder::key(out, "ts", true);
+        Encoder::string(out, scratch);
+    }
+    Encoder::key(out, "level", precision == TimestampPrecision::None);
+    Encoder::string(out, to_string(header.level));
+    if (header.file != nullptr) {
+        scratch.clear();
+        std::format_to(std::back_inserter(scratch), "{}:{}", std::string_view(header.file, header.file_size),
+                       header.line);
+        Encoder::key(out, "caller", false);
+        Encoder::string(out, scratch);
+    }
+    Encoder::key(out, "msg", false);
+    Encoder::string(out, message);
+    append_kv_fields<Encoder>(out, fields...);
+    Encoder::end(out);
+}
+
+// Binary record kinds, every record starts with one of these bytes
+enum class BinaryRecord : u8 {
+    End = 0,    // unused, zero filled space at the end of a mapping
+    Format = 1, // u32 id, u8 level, u32 line, then file, category, format string and arg types
+    Log = 2,    // u32 id, i64 timestamp, then the encoded arguments
+};
+
+// Assigns an id to every call site and appends its records to a BinaryFileSink. Strings are
+// written as a u32 size followed by the bytes. Eagerly formatted records become a "{}" format
+// with a single string argument.
+class BinaryWriter {
+public:
+    explicit BinaryWriter(BinaryFileSink sink) : m_sink(MOVE(sink)) {}
+
+    // Returns false when the file could not grow
+    bool write(const RecordHeader& header, const std::byte* payload) {
+        const Key key{header.deferred, header.fmt, header.file, header.line, header.category, header.level};
+        auto it = m_ids.find(key);
+        if (it == m_ids.end()) {
+            const auto id = static_cast<u32>(m_ids.size());
+            if (!write_format(header, id)) return false;
+            it = m_ids.emplace(key, id).first;
+        }
+
+        const bool deferred = header.deferred != nullptr;
+        const std::size_t args_size = deferred ? header.message_size : sizeof(std::size_t) + header.message_size;
+        const std::size_t size = 1 + sizeof(u32) + sizeof(i64) + sizeof(u32) + args_size;
+
+        std::byte* dest = m_sink.reserve(size);
+        if (dest == nullptr) return false;
+
+        dest = put(dest, BinaryRecord::Log);
+        dest = put(dest, it->second);
+        dest = put(dest, header.timestamp);
+        dest = put(dest, static_cast<u32>(args_size));
+        if (!deferred) dest = put(dest, header.message_size);
+        std::memcpy(dest, payload, header.message_size);
+        m_sink.commit(size);
+        return true;
+    }
+
+    void flush() const noexcept {
+        m_sink.flush();
+    }
+
+private:
+    struct Key {
+        const DeferredInfo* deferred;
+        const char* fmt;
+        const char* file;
+        u32 line;
+        const Category* category;
+        LogLevel level;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const noexcept {
+            std::size_t hash = std::hash<const void*>{}(key.fmt);
+            const auto combine = [&hash](const std::size_t value) {
+                hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+            };
+            combine(std::hash<const void*>{}(key.deferred));
+            combine(std::hash<const void*>{}(key.file));
+            combine(std::hash<const void*>{}(key.category));
+            combine((std::size_t{key.line} << 8) | static_cast<u8>(key.level));
+            return hash;
+        }
+    };
+
+    template <typename T>
+    static std::byte* put(std::byte* dest, const T& value) noexcept {
+        std::memcpy(dest, &value, sizeof(T));
+        return dest + sizeof(T);
+    }
+
+    static std::byte* put_string(std::byte* dest, const std::string_view value) noexcept {
+        dest = put(dest, static_cast<u32>(value.size()));
+        if (!value.empty()) std::memcpy(dest, value.data(), value.size());
+        return dest + value.size();
+    }
+
+    bool write_format(const RecordHeader& header, const u32 id) {
+        static constexpr std::array eager_types = {static_cast<u8>(ArgType::String)};
+
+        const std::string_view file = header.file != nullptr ? std::string_view(header.file, header.file_size) : "";
+        const std::string_view category = header.category != nullptr ? header.category->name() : "";
+        const std::string_view fmt = header.deferred != nullptr ? std::string_view(header.fmt, header.fmt_size) : "{}";
+        const std::span<const u8> types = header.deferred != nullptr ? header.deferred->arg_types : eager_types;
+        const std::string_view types_view(reinterpret_cast<const char*>(types.data()), types.size());
+
+        const std::size_t size = 1 + sizeof(u32) + 1 + sizeof(u32) + 4 * sizeof(u32) + file.size() +
+                                 category.size() + fmt.size() + types.size();
+        std::byte* dest = m_sink.reserve(size);
+        if (dest == nullptr) return false;
+
+        dest = put(dest, BinaryRecord::Format);
+        dest = put(dest, id);
+        dest = put(dest, header.level);
+        dest = put(dest, header.line);
+        dest = put_string(dest, file);
+        dest = put_string(dest, category);
+        dest = put_string(dest, fmt);
+        put_string(dest, types_view);
+        m_sink.commit(size);
+        return true;
+    }
+
+    BinaryFileSink m_sink;
+    std::unordered_map<Key, u32, KeyHash> m_ids;
+};
+
+class logger;
+
+class Backend {
+public:
+    explicit Backend(const AsyncOptions& options) : m_options(options), m_id(next_id()) {
+        m_thread = std::jthread([this](const std::stop_token& token) { run(token); });
+    }
+
+    Backend(const Backend&) = delete;
+    Backend& operator=(const Backend&) = delete;
+
+    ~Backend() {
+        stop();
+    }
+
+    // Joins the backend thread once every queue is drained
+    void stop() {
+        if (!m_thread.joinable()) return;
+        m_thread.request_stop();
+        m_thread.join();
+    }
+
+    // Waits until the backend thread has written every record pushed before the call
+    void flush() {
+        const u64 ticket = m_flush_requested.fetch_add(1, std::memory_order_release) + 1;
+        u64 completed = m_flush_completed.load(std::memory_order_acquire);
+        while (completed < ticket) {
+            m_flush_completed.wait(completed, std::memory_order_acquire);
+            completed = m_flush_completed.load(std::memory_order_acquire);
+        }
+    }
+
+    // Drains in place of the backend thread when it can take over within a few tries. Used from
+    // crash paths, so it does not wait for the backend thread to finish its current batch.
+    void crash_drain() {
+        std::unique_lock lock(m_drain_mutex, std::try_to_lock);
+        for (int i = 0; i < 100 && !lock.owns_lock(); ++i) {
+            std::this_thread::yield();
+            lock.try_lock();
+        }
+        if (!lock.owns_lock()) return;
+        for (int i = 0; i < 16 && drain(); ++i) {}
+    }
+
+    template <typename Writer>
+    void push(RecordHeader header, Writer&& write_message) {
+        header.timestamp = FastClock::instance().now();
+        ProducerContext& ctx = context();
+        const std::size_t size = sizeof(RecordHeader) + header.message_size;
+
+        std::byte* ptr = reserve(ctx, size);
+        if (ptr == nullptr) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::memcpy(ptr, &header, sizeof(RecordHeader));
+        write_message(ptr + sizeof(RecordHeader));
+        ctx.tail->queue.commit_write();
+    }
+
+    [[nodiscard]] bool deferred_format() const noexcept {
+        return m_options.deferred_format;
+    }
+
+    [[nodiscard]] u64 dropped() const noexcept {
+        return m_dropped_total.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct ThreadHandle {
+        ThreadHandle() = default;
+        ThreadHandle(const ThreadHandle&) = delete;
+        ThreadHandle& operator=(const ThreadHandle&) = delete;
+
+        ~ThreadHandle() {
+            if (ctx) ctx->closed.store(true, std::memory_order_release);
+        }
+
+        std::shared_ptr<ProducerContext> ctx;
+        u64 owner = 0;
+    };
+
+    static u64 next_id() {
+        static std::atomic<u64> id{0};
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    ProducerContext& context() {
+        thread_local ThreadHandle handle;
+        if (handle.owner != m_id) {
+            if (handle.ctx) handle.ctx->closed.store(true, std::memory_order_release);
+            handle.ctx = std::make_shared<ProducerContext>(m_options.queue_capacity);
+            handle.owner = m_id;
+
+            const std::lock_guard lock(m_contexts_mutex);
+            m_contexts.push_back(handle.ctx);
+            m_contexts_version.fetch_add(1, std::memory_order_release);
+        }
+        return *handle.ctx;
+    }
+
+    std::byte* reserve(ProducerContext& ctx, const std::size_t size) {
+        SpscQueue* queue = &ctx.tail->queue;
+
+        if (!queue->fits(size) && m_options.overflow != OverflowPolicy::Grow) return nullptr;
+
+        for (;;) {
+            if (std::byte* ptr = queue->prepare_write(size)) return ptr;
+
+            switch (m_options.overflow) {
+            case OverflowPolicy::Block:
+                std::this_thread::yield();
+                break;
+            case OverflowPolicy::Drop:
+                return nullptr;
+            case OverflowPolicy::Grow: {
+                std::size_t capacity = queue->capacity() * 2;
+                while (capacity < size + SpscQueue::header_size) capacity *= 2;
+                auto* node = new ProducerContext::Node(capacity);
+                ctx.tail->next.store(node, std::memory_order_release);
+                ctx.tail = node;
+                queue = &node->queue;
+                break;
+            }
+            default:
+                return nullptr;
+            }
+        }
+    }
+
+    void run(const std::stop_token& token) {
+        while (!token.stop_requested()) {
+            const u64 requested = m_flush_requested.load(std::memory_order_acquire);
+            if (requested != m_flush_completed.load(std::memory_order_relaxed)) {
+                while (locked_drain()) {}
+                complete_flush(requested);
+            } else if (!locked_drain()) {
+                flush_if_due();
+                std::this_thread::sleep_for(m_options.idle_sleep);
+            }
+        }
+        while (locked_drain()) {}
+        complete_flush(m_flush_requested.load(std::memory_order_acquire));
+    }
+
+    bool locked_drain() {
+        const std::lock_guard lock(m_drain_mutex);
+        return drain();
+    }
+
+    void complete_flush(u64 requested);
+    void flush_if_due();
+
+    // Drains every producer queue once and writes the batch, returns whether there was anything to do
+    bool drain();
+
+    const AsyncOptions m_options;
+    const u64 m_id; // distinguishes backends across start_async/stop_async cycles
+
+    std::mutex m_contexts_mutex;
+    std::vector<std::shared_ptr<ProducerContext>> m_contexts;
+    std::atomic<u64> m_contexts_version{0};
+
+    // Backend owned
+    std::vector<std::shared_ptr<ProducerContext>> m_snapshot;
+    u64 m_snapshot_version = ~u64{0};
+    std::string m_batch;
+
+    std::atomic<u64> m_dropped{0};
+    std::atomic<u64> m_dropped_total{0};
+
+    std::mutex m_drain_mutex; // only contended when a crashing thread drains
+    std::atomic<u64> m_flush_requested{0};
+    std::atomic<u64> m_flush_completed{0};
+
+    std::jthread m_thread; // last so it starts after and stops before everything else
+};
+
+// Writes a crash report on fatal signals and failed ASSERTs and TODOs: the reason, a backtrace
+// and the most recent log output. The report only uses async-signal-safe calls. After it the
+// logger writes its buffered lines best-effort before the process terminates, failed ASSERTs and
+// TODOs also drain the async queues, which needs formatting and is not done from signal handlers.
+class CrashHandler {
+public:
+    // Never destroyed, a crash during static destruction still finds it
+    static CrashHandler& instance() {
+        static auto* handler = new CrashHandler;
+        return *handler;
+    }
+
+    CrashHandler(const CrashHandler&) = delete;
+    CrashHandler& operator=(const CrashHandler&) = delete;
+
+    // Only the first call has an effect. The alternate signal stack, which lets the handler run
+    // after a stack overflow, is set up for the calling thread only.
+    void install(const CrashHandlerOptions& options);
+
+    [[nodiscard]] bool recording() const noexcept {
+        return m_recording.load(std::memory_order_relaxed);
+    }
+
+    // Keeps a copy of the log output, called with the sink mutex held
+    void record(std::string_view data) noexcept {
+        const std::size_t size = m_recent_size;
+        if (data.size() > size) data.remove_prefix(data.size() - size);
+
+        const u64 written = m_written.load(std::memory_order_relaxed);
+        const std::size_t pos = written % size;
+        const std::size_t first = std::min(data.size(), size - pos);
+        std::memcpy(m_recent + pos, data.data(), first);
+        std::memcpy(m_recent, data.data() + first, data.size() - first);
+        m_written.store(written + data.size(), std::memory_order_release);
+    }
+
+private:
+    CrashHandler() = default;
+
+    static void on_signal(int signal);
+    static void on_abort();
+
+    static const char* signal_name(const int signal) noexcept {
+        switch (signal) {
+        case SIGSEGV:
+            return "SIGSEGV";
+        case SIGABRT:
+            return "SIGABRT";
+        case SIGFPE:
+            return "SIGFPE";
+        case SIGILL:
+            return "SIGILL";
+#ifndef _WIN32
+        case SIGBUS:
+            return "SIGBUS";
+#endif // _WIN32
+        default:
+            return "unknown signal";
+        }
+    }
+
+    void write(const std::string_view data) const noexcept {
+        write_all(m_fd, data);
+    }
+
+    // Only the first crash of the process gets a report
+    void report(const char* reason) noexcept {
+        if (m_fd < 0 || m_reported.exchange(true)) return;
+
+        write("\n*** Crash: ");
+        write(reason);
+        write(" ***\n");
+
+#if UTILS_LOG_HAS_BACKTRACE
+        if (m_backtrace) {
+            std::array<void*, 64> frames{};
+            const int count = ::backtrace(frames.data(), static_cast<int>(frames.size()));
+            write("Backtrace:\n");
+            ::backtrace_symbols_fd(frames.data(), count, m_fd);
+        }
+#endif
+
+        if (m_recent_size > 0) {
+            const u64 written = m_written.load(std::memory_order_acquire);
+            write("Recent log output:\n");
+            if (written <= m_recent_size) {
+                write({m_recent, static_cast<std::size_t>(written)});
+            } else {
+                // Oldest to newest, starting after the first partial line
+                const std::size_t pos = written % m_recent_size;
+                std::string_view older(m_recent + pos, m_recent_size - pos);
+                const std::string_view newer(m_recent, pos);
+                if (const std::size_t newline = older.find('\n'); newline != std::string_view::npos) {
+                    older.remove_prefix(newline + 1);
+                    write(older);
+                    write(newer);
+                } else if (const std::size_t first_line = newer.find('\n'); first_line != std::string_view::npos) {
+                    write(newer.substr(first_line + 1));
+                }
+            }
+        }
+        write("*** End of crash report ***\n");
+    }
+
+    std::atomic<bool> m_recording{false};
+    std::atomic<bool> m_reported{false};
+    bool m_installed = false;
+
+    int m_fd = 2;
+    bool m_backtrace = true;
+    char* m_recent = nullptr; // never freed, like the handler itself
+    std::size_t m_recent_size = 0;
+    std::atomic<u64> m_written{0};
+    utils::AbortHandler m_previous_abort_handler = nullptr;
+};
+
+class logger {
+public:
+    static logger& instance() {
+        static logger logger;
+        return logger;
+    }
+
+    logger(const logger&) = delete;
+    logger& operator=(const logger&) = delete;
+
+    // Also applies to every category without a level of its own
+    void set_log_level(const LogLevel level) {
+        const std::lock_guard lock(m_categories_mutex);
+        m_level.store(level, std::memory_order_relaxed);
+        for (const auto& category : m_categories) {
+            if (!category->m_explicit) category->m_level.store(level, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]] LogLevel log_level() const {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool enabled(const LogLevel level) const {
+        return level >= log_level();
+    }
+
+    // Calibrates the clock right away so the first timestamped call does not pay for it
+    void set_timestamp_precision(const TimestampPrecision precision) {
+        if (precision != TimestampPrecision::None) FastClock::instance();
+        m_timestamp_precision.store(precision, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] TimestampPrecision timestamp_precision() const {
+        return m_timestamp_precision.load(std::memory_order_relaxed);
+    }
+
+    void set_kv_format(const KvFormat format) {
+        m_kv_format.store(format, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] KvFormat kv_format() const {
+        return m_kv_format.load(std::memory_order_relaxed);
+    }
+
+    // Returns the category with the given name, creating it on first use
+    Category& category(const std::string_view name) {
+        const std::lock_guard lock(m_categories_mutex);
+        return find_or_create(name);
+    }
+
+    void set_category_level(const std::string_view name, const LogLevel level) {
+        const std::lock_guard lock(m_categories_mutex);
+        Category& category = find_or_create(name);
+        category.m_explicit = true;
+        category.m_level.store(level, std::memory_order_relaxed);
+    }
+
+    // Makes the category follow the global level again
+    void reset_category_level(const std::string_view name) {
+        const std::lock_guard lock(m_categories_mutex);
+        Category& category = find_or_create(name);
+        category.m_explicit = false;
+        category.m_level.store(log_level(), std::memory_order_relaxed);
+    }
+
+    template <LogLevel L, typename... Args>
+    constexpr void log(const std::format_string<Args...> fmt, Args&&... args) {
+        if (!enabled(L)) return;
+        submit<Args...>({.level = L}, fmt, FORWARD(args)...);
+    }
+
+    template <LogLevel L, typename... Args>
+    constexpr void log(const Category& category, const std::format_string<Args...> fmt, Args&&... args) {
+        if (!category.enabled(L)) return;
+        submit<Args...>({.level = L, .category = &category}, fmt, FORWARD(args)...);
+    }
+
+    template <typename... Args>
+    constexpr void debug(const std::format_string<Args...> fmt, std::string_view file, int line, Args&&... args) {
+        if (!enabled(LogLevel::DEBUG)) return;
+        submit<Args...>(
+            {.level = LogLevel::DEBUG, .line = static_cast<u32>(line), .file = file.data(), .file_size = file.size()},
+            fmt, FORWARD(args)...);
+    }
+
+    template <typename... Args>
+    constexpr void debug(const Category& category, const std::format_string<Args...> fmt, std::string_view file,
+                         int line, Args&&... args) {
+        if (!category.enabled(LogLevel::DEBUG)) return;
+        submit<Args...>({.level = LogLevel::DEBUG,
+                         .line = static_cast<u32>(line),
+                         .file = file.data(),
+                         .file_size = file.size(),
+                         .category = &category},
+                        fmt, FORWARD(args)...);
+    }
+
+    // Collects lines and writes them to the sink in batches, see BufferOptions
+    void enable_buffering(const BufferOptions& options) {
+        const std::lock_guard lock(m_sink_mutex);
+        m_buffer_options = options;
+        m_buffering = true;
+    }
+
+    // Writes out what is buffered, every line goes straight to the sink again
+    void disable_buffering() {
+        const std::lock_guard lock(m_sink_mutex);
+        m_buffer.write_to(m_sink);
+        m_buffering = false;
+    }
+
+    // Writes every record logged so far, including queued and buffered ones, and flushes the sink
+    void flush() {
+        {
+            const std::lock_guard lock(m_backend_mutex);
+            if (m_backend_owner) m_backend_owner->flush();
+        }
+        flush_sink();
+    }
+
+    // Best effort from a crashing thread: drains the queues and writes buffered lines. Locks held
+    // elsewhere, possibly by the crashing thread itself, are skipped instead of waited for.
+    void crash_flush() {
+        if (m_crashing.exchange(true)) return;
+        if (Backend* backend = m_backend.load(std::memory_order_acquire)) backend->crash_drain();
+
+        const std::unique_lock lock = acquire(m_sink_mutex);
+        if (!lock.owns_lock()) return;
+        m_buffer.write_to(m_sink);
+        m_sink.flush();
+    }
+
+    // crash_flush for signal handlers: only lines that are already formatted in the buffer are
+    // written, with plain write calls to the sink's descriptor. Queued records are left alone,
+    // formatting them allocates, which deadlocks when the signal was raised inside malloc.
+    void signal_flush() noexcept {
+        if (m_crashing.exchange(true)) return;
+        const std::unique_lock lock(m_sink_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;
+        if (const int fd = m_sink.fd(); fd >= 0) m_buffer.write_to_fd(fd);
+    }
+
+    template <LogLevel L, typename... Fields>
+    void log_kv(const std::string_view message, const Fields&... fields) {
+        if (!enabled(L)) return;
+        submit_kv({.level = L}, message, fields...);
+    }
+
+    template <typename... Fields>
+    void debug_kv(const std::string_view message, std::string_view file, int line, const Fields&... fields) {
+        if (!enabled(LogLevel::DEBUG)) return;
+        submit_kv(
+            {.level = LogLevel::DEBUG, .line = static_cast<u32>(line), .file = file.data(), .file_size = file.size()},
+            message, fields...);
+    }
+
+    // Starts the backend thread, from now on callers only format into their own queue
+    void start_async(const AsyncOptions& options) {
+        const std::lock_guard lock(m_backend_mutex);
+        if (m_backend_owner) return;
+        FastClock::instance();
+        m_backend_owner = std::make_unique<Backend>(options);
+        m_backend.store(m_backend_owner.get(), std::memory_order_release);
+    }
+
+    // Stops the backend thread after writing every queued record. Must not race with logging calls.
+    void stop_async() {
+        const std::lock_guard lock(m_backend_mutex);
+        m_backend.store(nullptr, std::memory_order_release);
+        if (!m_backend_owner) return;
+        m_backend_owner->stop();
+        m_dropped_before += m_backend_owner->dropped();
+        m_backend_owner.reset();
+        flush_sink();
+    }
+
+    // Replaces the sink, the previous one receives the buffered lines and is flushed and destroyed
+    template <Sink S>
+    void set_sink(S sink) {
+        AnySink replacement(MOVE(sink));
+        const std::lock_guard lock(m_sink_mutex);
+        m_buffer.write_to(m_sink);
+        m_sink.flush();
+        std::swap(m_sink, replacement);
+    }
+
+    void flush_sink() {
+        const std::lock_guard lock(m_sink_mutex);
+        m_buffer.write_to(m_sink);
+        m_sink.flush();
+    }
+
+    // Async records go to the binary file instead of the text sink until reset_binary_sink
+    void set_binary_sink(BinaryFileSink sink) {
+        const std::lock_guard lock(m_binary_mutex);
+        m_binary.emplace(MOVE(sink));
+    }
+
+    // Closes the binary file, the backend formats records as text again
+    void reset_binary_sink() {
+        const std::lock_guard lock(m_binary_mutex);
+        m_binary.reset();
+    }
+
+    // Total number of records discarded by OverflowPolicy::Drop
+    [[nodiscard]] u64 dropped_count() {
+        const std::lock_guard lock(m_backend_mutex);
+        return m_dropped_before + (m_backend_owner ? m_backend_owner->dropped() : 0);
+    }
+
+private:
+    friend class Backend;
+
+    logger() : m_previous_abort_handler(utils::set_abort_handler(&on_abort)) {}
+
+    ~logger() {
+        stop_async();
+        flush_sink();
+        utils::set_abort_handler(m_previous_abort_handler);
+    }
+
+    static void on_abort() {
+        logger& instance = logger::instance();
+        instance.crash_flush();
+        if (instance.m_previous_abort_handler != nullptr) instance.m_previous_abort_handler();
+    }
+
+    // Blocks normally, but only tries once the process is crashing
+    [[nodiscard]] std::unique_lock<std::mutex> acquire(std::mutex& mutex) const {
+        if (!m_crashing.load(std::memory_order_relaxed)) return std::unique_lock(mutex);
+        return std::unique_lock(mutex, std::try_to_lock);
+    }
+
+    Category& find_or_create(const std::string_view name) {
+        for (const auto& category : m_categories) {
+            if (category->name() == name) return *category;
+        }
+        return *m_categories.emplace_back(std::make_unique<Category>(std::string(name), log_level()));
+    }
+
+    template <typename... Args>
+    void submit(const RecordHeader& header, const std::format_string<Args...> fmt, Args&&... args) {
+        if (Backend* backend = m_backend.load(std::memory_order_acquire)) {
+            push<Args...>(*backend, header, fmt, FORWARD(args)...);
+            return;
+        }
+
+        thread_local std::string buffer;
+        buffer.clear();
+        if (const TimestampPrecision precision = timestamp_precision(); precision != TimestampPrecision::None) {
+            RecordHeader stamped = header;
+            stamped.timestamp = FastClock::instance().now();
+            begin_line(buffer, stamped, precision);
+        } else {
+            begin_line(buffer, header, precision);
+        }
+        std::format_to(std::back_inserter(buffer), fmt, FORWARD(args)...);
+        end_line(buffer);
+        write_to_sink(buffer);
+    }
+
+    // Key-value lines are always encoded on the caller thread, the backend copies them as they are
+    template <typename... Fields>
+    void submit_kv(RecordHeader header, const std::string_view message, const Fields&... fields) {
+        static_assert(sizeof...(Fields) % 2 == 0, "key-value log calls take pairs of keys and values");
+
+        thread_local std::string buffer;
+        buffer.clear();
+        const TimestampPrecision precision = timestamp_precision();
+        if (precision != TimestampPrecision::None) header.timestamp = FastClock::instance().now();
+        if (kv_format() == KvFormat::Json) {
+            encode_kv<JsonEncoder>(buffer, header, precision, message, fields...);
+        } else {
+            encode_kv<LogfmtEncoder>(buffer, header, precision, message, fields...);
+        }
+
+        if (Backend* backend = m_backend.load(std::memory_order_acquire)) {
+            header.structured = true;
+            header.message_size = buffer.size();
+            backend->push(header, [&](std::byte* dest) { std::memcpy(dest, buffer.data(), buffer.size()); });
+            return;
+        }
+
+        buffer += '\n';
+        write_to_sink(buffer);
+    }
+
+    // Either copies the raw arguments or formats straight into the queue, in the latter case
+    // std::formatted_size lets us reserve the exact record size
+    template <typename... Args>
+    static void push(Backend& backend, RecordHeader header, const std::format_string<Args...> fmt, Args&&... args) {
+        if constexpr ((deferrable<Args>() && ...)) {
+            if (backend.deferred_format()) {
+                header.message_size = (std::size_t{0} + ... + codec_t<Args>::size(args));
+                header.deferred = &deferred_info<Args...>;
+                header.fmt = fmt.get().data();
+                header.fmt_size = fmt.get().size();
+                backend.push(header, [&](std::byte* dest) {
+                    ((dest = codec_t<Args>::encode(dest, args)), ...);
+                    UNUSED(dest);
+                });
+                return;
+            }
+        }
+
+        header.message_size = std::formatted_size(fmt, FORWARD(args)...);
+        backend.push(header, [&](std::byte* dest) {
+            std::format_to(reinterpret_cast<char*>(dest), fmt, FORWARD(args)...);
+        });
+    }
+
+    // Everything in front of the message: "timestamp [LEVEL] [category] [file:line] ". The colour
+    // starts after the timestamp, so the timestamps line up the same with and without colours.
+    void begin_line(std::string& buffer, const RecordHeader& header, const TimestampPrecision precision) const {
+        if (precision != TimestampPrecision::None) {
+            thread_local TimestampCache cache;
+            cache.append(buffer, header.timestamp, timestamp_digits(precision));
+            buffer += ' ';
+        }
+
+#ifdef LOG_COLOR
+        switch (header.level) {
+        case LogLevel::DEBUG:
+            buffer += debug_color;
+            break;
+        case LogLevel::INFO:
+            buffer += info_color;
+            break;
+        case LogLevel::WARNING:
+            buffer += warning_color;
+            break;
+        case LogLevel::ERROR:
+            buffer += error_color;
+            break;
+        default:
+            break;
+        }
+#endif
+
+        buffer += '[';
+        buffer += to_string(header.level);
+        buffer += "] ";
+        if (header.category != nullptr) {
+            buffer += '[';
+            buffer += header.category->name();
+            buffer += "] ";
+        }
+        if (header.file != nullptr) {
+            std::format_to(std::back_inserter(buffer), "[{}:{}] ", std::string_view(header.file, header.file_size),
+                           header.line);
+        }
+    }
+
+    static void end_line(std::string& buffer) {
+#ifdef LOG_COLOR
+        buffer += color::reset;
+#endif
+        buffer += '\n';
+    }
+
+    void write_to_sink(const std::string_view data) {
+        const std::unique_lock lock = acquire(m_sink_mutex);
+        if (!lock.owns_lock()) return;
+        if (CrashHandler& crash = CrashHandler::instance(); crash.recording()) crash.record(data);
+        if (!m_buffering) {
+            m_sink.write(data);
+            return;
+        }
+
+        const i64 now = FastClock::instance().now();
+        if (m_buffer.empty()) m_buffer_start = now;
+        m_buffer.append(data);
+        if (m_buffer.size() >= m_buffer_options.max_bytes || buffer_due(now)) m_buffer.write_to(m_sink);
+    }
+
+    [[nodiscard]] bool buffer_due(const i64 now) const {
+        return now - m_buffer_start >= std::chrono::nanoseconds(m_buffer_options.max_delay).count();
+    }
+
+    void flush_buffer_if_due() {
+        const std::lock_guard lock(m_sink_mutex);
+        if (!m_buffer.empty() && buffer_due(FastClock::instance().now())) m_buffer.write_to(m_sink);
+    }
+
+    std::atomic<LogLevel> m_level{LogLevel::INFO};
+    std::atomic<TimestampPrecision> m_timestamp_precision{TimestampPrecision::None};
+    std::atomic<KvFormat> m_kv_format{KvFormat::Logfmt};
+
+    std::mutex m_categories_mutex;
+    std::vector<std::unique_ptr<Category>> m_categories;
+
+    std::mutex m_sink_mutex;
+    AnySink m_sink{StderrSink{}};
+    CoalescingWriter m_buffer;
+    BufferOptions m_buffer_options;
+    bool m_buffering = false;
+    i64 m_buffer_start = 0; // when the oldest buffered line was added
+
+    std::atomic<bool> m_crashing{false};
+    utils::AbortHandler m_previous_abort_handler;
+
+    std::mutex m_binary_mutex;
+    std::optional<BinaryWriter> m_binary;
+
+    std::mutex m_backend_mutex;
+    std::unique_ptr<Backend> m_backend_owner;
+    std::atomic<Backend*> m_backend{nullptr};
+    u64 m_dropped_before = 0;
+
+    std::string_view debug_color   = color::white;
+    std::string_view info_color    = color::cyan;
+    std::string_view warning_color = color::yellow;
+    std::string_view error_color   = color::red;
+};
+
+inline bool Backend::drain() {
+    if (const u64 version = m_contexts_version.load(std::memory_order_acquire); version != m_snapshot_version) {
+        const std::lock_guard lock(m_contexts_mutex);
+        m_snapshot = m_contexts;
+        m_snapshot_version = version;
+    }
+
+    logger& instance = logger::instance();
+    const TimestampPrecision precision = instance.timestamp_precision();
+    bool removed = false;
+    bool consumed = false;
+    const std::unique_lock binary_lock = instance.acquire(instance.m_binary_mutex);
+    BinaryWriter* binary = binary_lock.owns_lock() && instance.m_binary ? &*instance.m_binary : nullptr;
+
+    for (const auto& ctx : m_snapshot) {
+        // Read closed first, anything pushed before it was set is visible to the loop below
+        const bool closed = ctx->closed.load(std::memory_order_acquire);
+
+        for (;;) {
+            ProducerContext::Node* node = ctx->head;
+            while (const std::byte* record = node->queue.front()) {
+                consumed = true;
+                RecordHeader header;
+                std::memcpy(&header, record, sizeof(RecordHeader));
+                const std::byte* payload = record + sizeof(RecordHeader);
+
+                if (binary != nullptr) {
+                    if (!binary->write(header, payload)) m_dropped.fetch_add(1, std::memory_order_relaxed);
+                    node->queue.pop();
+                    continue;
+                }
+
+                if (header.structured) {
+                    m_batch.append(reinterpret_cast<const char*>(payload), header.message_size);
+                    m_batch += '\n';
+                    node->queue.pop();
+                    continue;
+                }
+
+                instance.begin_line(m_batch, header, precision);
+                if (header.deferred != nullptr) {
+                    header.deferred->format(m_batch, std::string_view(header.fmt, header.fmt_size), payload);
+                } else {
+                    m_batch.append(reinterpret_cast<const char*>(payload), header.message_size);
+                }
+                logger::end_line(m_batch);
+                node->queue.pop();
+            }
+
+            // The producer never writes to a node again once it links the next one, but records
+            // committed right before the switch only become visible after loading next
+            ProducerContext::Node* next = node->next.load(std::memory_order_acquire);
+            if (next == nullptr) break;
+            if (node->queue.front() != nullptr) continue;
+            ctx->head = next;
+            delete node;
+        }
+
+        if (closed && ctx->finished()) removed = true;
+    }
+
+    if (const u64 dropped = m_dropped.exchange(0, std::memory_order_relaxed); dropped > 0) {
+        m_dropped_total.fetch_add(dropped, std::memory_order_relaxed);
+        instance.begin_line(m_batch, {.level = LogLevel::WARNING, .timestamp = FastClock::instance().now()}, precision);
+        std::format_to(std::back_inserter(m_batch), "Dropped {} log records due to full queue", dropped);
+        logger::end_line(m_batch);
+    }
+
+    if (removed) {
+        const std::lock_guard lock(m_contexts_mutex);
+        std::erase_if(m_contexts, [](const auto& ctx) { return ctx->finished(); });
+        m_contexts_version.fetch_add(1, std::memory_order_release);
+    }
+
+    if (m_batch.empty()) return consumed;
+
+    instance.write_to_sink(m_batch);
+    m_batch.clear();
+    return true;
+}
+
+inline void Backend::complete_flush(const u64 requested) {
+    logger::instance().flush_sink();
+    m_flush_completed.store(requested, std::memory_order_release);
+    m_flush_completed.notify_all();
+}
+
+inline void Backend::flush_if_due() {
+    logger::instance().flush_buffer_if_due();
+}
+
+// Call site state of the rate limited macros, each macro keeps one in a static. They are only
+// consulted once the level check passes, a suppressed call never formats anything.
+
+// Passes the 1st, (n+1)th, (2n+1)th... call
+class EveryN {
+public:
+    bool operator()(const u64 n) noexcept {
+        return n <= 1 || m_count.fetch_add(1, std::memory_order_relaxed) % n == 0;
+    }
+
+private:
+    std::atomic<u64> m_count{0};
+};
+
+// Passes the first n calls, stops touching the counter afterwards
+class FirstN {
+public:
+    bool operator()(const u64 n) noexcept {
+        return m_count.load(std::memory_order_relaxed) < n && m_count.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+
+private:
+    std::atomic<u64> m_count{0};
+};
+
+// Passes at most one call per interval, the thread that wins the exchange logs
+class EveryMs {
+public:
+    bool operator()(const i64 ms) noexcept {
+        const i64 now = FastClock::instance().now();
+        i64 next = m_next.load(std::memory_order_relaxed);
+        if (now < next) return false;
+        return m_next.compare_exchange_strong(next, now + ms * 1'000'000, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<i64> m_next{0};
+};
+
+// Passes each call with the given probability, using a per thread xorshift generator
+class Sample {
+public:
+    bool operator()(const double probability) const noexcept {
+        if (probability >= 1.0) return true;
+        if (probability <= 0.0) return false;
+
+        thread_local u64 state = (std::hash<std::thread::id>{}(std::this_thread::get_id()) ^ FastClock::ticks()) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<double>(state >> 11) * 0x1p-53 < probability;
+    }
+};
+
+// Spans recorded by one thread. The thread appends, the tracer reads under its mutex, so a
+// span costs two clock reads and a store. When the buffer is full new spans are dropped.
+class TraceBuffer {
+public:
+    static constexpr std::size_t capacity = 16384;
+
+    struct Span {
+        const char* name;
+        u64 start; // FastClock ticks
+        u64 end;
+        u32 generation; // the trace that was open when the span started
+    };
+
+    explicit TraceBuffer(const u32 tid) : m_spans(capacity), m_tid(tid) {}
+
+    void push(const char* name, const u64 start, const u64 end, const u32 generation) noexcept {
+        const u64 write = m_write.load(std::memory_order_relaxed);
+        if (write - m_read.load(std::memory_order_acquire) >= capacity) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        m_spans[write % capacity] = {name, start, end, generation};
+        m_write.store(write + 1, std::memory_order_release);
+    }
+
+    template <typename F>
+    void consume(F&& f) {
+        const u64 write = m_write.load(std::memory_order_acquire);
+        u64 read = m_read.load(std::memory_order_relaxed);
+        for (; read != write; ++read) f(m_spans[read % capacity]);
+        m_read.store(read, std::memory_order_release);
+    }
+
+    [[nodiscard]] u32 tid() const noexcept {
+        return m_tid;
+    }
+
+    u64 take_dropped() noexcept {
+        return m_dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<bool> closed{false}; // set when the thread exits
+
+private:
+    std::vector<Span> m_spans;
+    const u32 m_tid;
+    alignas(64) std::atomic<u64> m_write{0};
+    alignas(64) std::atomic<u64> m_read{0};
+    std::atomic<u64> m_dropped{0};
+};
+
+// Collects the spans of every thread and writes them to the trace sink as Chrome trace events
+// in the JSON array format, which chrome://tracing and Perfetto both load
+class Tracer {
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    ~Tracer() {
+        close();
+    }
+
+    [[nodiscard]] bool enabled() const noexcept {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Changes with every open, so spans that outlive their trace are not written to the next one
+    [[nodiscard]] u32 generation() const noexcept {
+        return m_generation.load(std::memory_order_relaxed);
+    }
+
+    // The calling thread's buffer, registered on first use
+    TraceBuffer& buffer() {
+        struct Handle {
+            Handle() = default;
+            Handle(const Handle&) = delete;
+            Handle& operator=(const Handle&) = delete;
+
+            ~Handle() {
+                if (buffer) buffer->closed.store(true, std::memory_order_release);
+            }
+
+            std::shared_ptr<TraceBuffer> buffer;
+        };
+
+        thread_local Handle handle;
+        if (!handle.buffer) {
+            const std::lock_guard lock(m_mutex);
+            handle.buffer = std::make_shared<TraceBuffer>(m_next_tid++);
+            m_buffers.push_back(handle.buffer);
+        }
+        return *handle.buffer;
+    }
+
+    // Closes the current trace, then starts a new one in sink and enables TRACE_SCOPE
+    template <Sink S>
+    void open(S sink) {
+        FastClock::instance();
+        const std::lock_guard lock(m_mutex);
+        close_locked();
+        m_sink.emplace(MOVE(sink));
+        m_sink->write("[\n");
+        m_first = true;
+        m_generation.fetch_add(1, std::memory_order_relaxed);
+        m_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    // Writes the spans recorded since the last flush
+    void flush() {
+        const std::lock_guard lock(m_mutex);
+        flush_locked();
+    }
+
+    // Disables TRACE_SCOPE, writes the remaining spans and terminates the JSON array
+    void close() {
+        const std::lock_guard lock(m_mutex);
+        close_locked();
+    }
+
+private:
+    Tracer() = default;
+
+    void close_locked() {
+        m_enabled.store(false, std::memory_order_relaxed);
+        if (!m_sink) return;
+        flush_locked();
+        m_sink->write("\n]\n");
+        m_sink->flush();
+        m_sink.reset();
+    }
+
+    void flush_locked() {
+        if (!m_sink) return;
+        const FastClock& clock = FastClock::instance();
+        const u32 generation = m_generation.load(std::memory_order_relaxed);
+        m_output.clear();
+
+        for (const auto& buffer : m_buffers) {
+            buffer->consume([&](const TraceBuffer::Span& span) {
+                if (span.generation != generation) return;
+
+                // Microseconds with nanosecond decimals
+                const i64 start = clock.to_ns(span.start);
+                const i64 duration = std::max(clock.to_ns(span.end) - start, i64{0});
+                begin_event(span.name);
+                std::format_to(std::back_inserter(m_output), R"("ph":"X","ts":{}.{:03},"dur":{}.{:03},)", start / 1000,
+                               start % 1000, duration / 1000, duration % 1000);
+                std::format_to(std::back_inserter(m_output), R"("pid":1,"tid":{}}})", buffer->tid());
+            });
+            if (const u64 dropped = buffer->take_dropped(); dropped > 0) {
+                begin_event("dropped spans");
+                std::format_to(std::back_inserter(m_output), R"("ph":"i","s":"t","ts":{},"pid":1,"tid":{},)",
+                               clock.to_ns(FastClock::ticks()) / 1000, buffer->tid());
+                std::format_to(std::back_inserter(m_output), R"("args":{{"count":{}}}}})", dropped);
+            }
+        }
+        std::erase_if(m_buffers, [](const auto& buffer) {
+            return buffer->closed.load(std::memory_order_acquire) && buffer.use_count() == 1;
+        });
+
+        if (m_output.empty()) return;
+        m_sink->write(m_output);
+        m_sink->flush();
+    }
+
+    void begin_event(const char* name) {
+        if (!m_first) m_output += ",\n";
+        m_first = false;
+        m_output += R"({"name":)";
+        JsonEncoder::string(m_output, name);
+        m_output += ',';
+    }
+
+    std::atomic<bool> m_enabled{false};
+    std::atomic<u32> m_generation{0};
+
+    std::mutex m_mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> m_buffers;
+    u32 m_next_tid = 1;
+    std::optional<AnySink> m_sink;
+    std::string m_output;
+    bool m_first = true;
+};
+
+} // namespace detail
+
+// Records the time between construction and destruction as a span when tracing is enabled.
+// The name must outlive the trace, e.g. a string literal.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : m_name(name) {
+        detail::Tracer& tracer = detail::Tracer::instance();
+        m_generation = tracer.generation();
+        if (!tracer.enabled()) return;
+        m_buffer = &tracer.buffer();
+        m_start = detail::FastClock::ticks();
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    ~TraceScope() {
+        if (m_buffer != nullptr) m_buffer->push(m_name, m_start, detail::FastClock::ticks(), m_generation);
+    }
+
+private:
+    const char* m_name;
+    detail::TraceBuffer* m_buffer = nullptr;
+    u64 m_start = 0;
+    u32 m_generation = 0;
+};
+
+// Starts writing spans to sink, e.g. set_trace_sink(FdSink::open("trace.json").value())
+template <Sink S>
+void set_trace_sink(S sink) {
+    detail::Tracer::instance().open(MOVE(sink));
+}
+
+inline void flush_trace() {
+    detail::Tracer::instance().flush();
+}
+
+inline void close_trace() {
+    detail::Tracer::instance().close();
+}
+
+inline void set_log_level(const LogLevel level) {
+    detail::logger::instance().set_log_level(level);
+}
+
+inline LogLevel log_level() {
+    return detail::logger::instance().log_level();
+}
+
+inline void set_timestamp_precision(const TimestampPrecision precision) {
+    detail::logger::instance().set_timestamp_precision(precision);
+}
+
+inline TimestampPrecision timestamp_precision() {
+    return detail::logger::instance().timestamp_precision();
+}
+
+inline void set_kv_format(const KvFormat format) {
+    detail::logger::instance().set_kv_format(format);
+}
+
+inline KvFormat kv_format() {
+    return detail::logger::instance().kv_format();
+}
+
+inline Category& category(const std::string_view name) {
+    return detail::logger::instance().category(name);
+}
+
+// Overrides the global level for one category, can be called before the category is first used
+inline void set_category_level(const std::string_view name, const LogLevel level) {
+    detail::logger::instance().set_category_level(name, level);
+}
+
+inline void reset_category_level(const std::string_view name) {
+    detail::logger::instance().reset_category_level(name);
+}
+
+inline void start_async(const AsyncOptions& options = {}) {
+    detail::logger::instance().start_async(options);
+}
+
+inline void stop_async() {
+    detail::logger::instance().stop_async();
+}
+
+template <Sink S>
+void set_sink(S sink) {
+    detail::logger::instance().set_sink(MOVE(sink));
+}
+
+inline u64 dropped_count() {
+    return detail::logger::instance().dropped_count();
+}
+
+inline void enable_buffering(const BufferOptions& options = {}) {
+    detail::logger::instance().enable_buffering(options);
+}
+
+inline void disable_buffering() {
+    detail::logger::instance().disable_buffering();
+}
+
+// Returns once everything logged before the call is written to the sink and the sink is flushed
+inline void flush() {
+    detail::logger::instance().flush();
+}
+
+namespace detail {
+
+inline void CrashHandler::install(const CrashHandlerOptions& options) {
+    logger::instance(); // its abort handler comes first in the chain
+    if (m_installed) return;
+    m_installed = true;
+
+    m_fd = options.fd;
+    m_backtrace = options.backtrace;
+    if (options.fd >= 0 && options.recent_bytes > 0) {
+        m_recent = new char[options.recent_bytes];
+        m_recent_size = options.recent_bytes;
+        m_recording.store(true, std::memory_order_relaxed);
+    }
+
+#if UTILS_LOG_HAS_BACKTRACE
+    // The first call may load libgcc, which is not safe from a signal handler
+    std::array<void*, 1> frame{};
+    ::backtrace(frame.data(), 1);
+#endif
+
+    m_previous_abort_handler = utils::set_abort_handler(&on_abort);
+
+#ifdef _WIN32
+    for (const int signal : {SIGSEGV, SIGFPE, SIGILL, SIGABRT}) std::signal(signal, &on_signal);
+#else
+    constexpr std::size_t alt_stack_size = std::size_t{64} << 10;
+    stack_t stack{};
+    stack.ss_sp = new char[alt_stack_size]; // never freed, the handler may run at any time
+    stack.ss_size = alt_stack_size;
+    sigaltstack(&stack, nullptr);
+
+    struct sigaction action {};
+    action.sa_handler = &on_signal;
+    action.sa_flags = static_cast<int>(SA_RESETHAND | SA_ONSTACK);
+    sigemptyset(&action.sa_mask);
+    for (const int signal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) sigaction(signal, &action, nullptr);
+#endif // _WIN32
+}
+
+inline void CrashHandler::on_signal(const int signal) {
+    instance().report(signal_name(signal));
+    logger::instance().signal_flush();
+    // The handler was reset to the default, the signal terminates the process once we return
+    std::raise(signal);
+}
+
+inline void CrashHandler::on_abort() {
+    CrashHandler& handler = instance();
+    handler.report("ASSERT or TODO failed");
+    if (handler.m_previous_abort_handler != nullptr) handler.m_previous_abort_handler();
+}
+
+} // namespace detail
+
+// Reports SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT and failed ASSERTs and TODOs, then writes buffered
+// lines, and for ASSERTs and TODOs queued ones too, before the process terminates as usual
+inline void install_crash_handler(const CrashHandlerOptions& options = {}) {
+    detail::CrashHandler::instance().install(options);
+}
+
+inline void set_binary_sink(BinaryFileSink sink) {
+    detail::logger::instance().set_binary_sink(MOVE(sink));
+}
+
+inline void reset_binary_sink() {
+    detail::logger::instance().reset_binary_sink();
+}
+
+namespace detail {
+
+class BinaryReader {
+public:
+    explicit BinaryReader(const std::string_view data) noexcept : m_data(data) {}
+
+    [[nodiscard]] bool done() const noexcept {
+        return m_pos == m_data.size();
+    }
+
+    template <typename T>
+    bool read(T& value) noexcept {
+        if (m_data.size() - m_pos < sizeof(T)) return false;
+        std::memcpy(&value, m_data.data() + m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return true;
+    }
+
+    bool read(std::string_view& value, const std::size_t size) noexcept {
+        if (m_data.size() - m_pos < size) return false;
+        value = m_data.substr(m_pos, size);
+        m_pos += size;
+        return true;
+    }
+
+    bool read_string(std::string_view& value) noexcept {
+        u32 size;
+        return read(size) && read(value, size);
+    }
+
+private:
+    std::string_view m_data;
+    std::size_t m_pos = 0;
+};
+
+// Size of the argument encoded at the front of args, nullopt if it is malformed or truncated.
+// Custom arguments may legitimately be empty
+inline std::optional<std::size_t> binary_arg_size(const std::string_view type, const std::string_view args) noexcept {
+    std::size_t size = 0;
+    switch (static_cast<ArgType>(type[0])) {
+    case ArgType::Bool:       size = sizeof(bool); break;
+    case ArgType::Char:       size = sizeof(char); break;
+    case ArgType::I8:         size = sizeof(i8); break;
+    case ArgType::I16:        size = sizeof(i16); break;
+    case ArgType::I32:        size = sizeof(i32); break;
+    case ArgType::I64:        size = sizeof(i64); break;
+    case ArgType::U8:         size = sizeof(u8); break;
+    case ArgType::U16:        size = sizeof(u16); break;
+    case ArgType::U32:        size = sizeof(u32); break;
+    case ArgType::U64:        size = sizeof(u64); break;
+    case ArgType::F32:        size = sizeof(f32); break;
+    case ArgType::F64:        size = sizeof(f64); break;
+    case ArgType::LongDouble: size = sizeof(long double); break;
+    case ArgType::Pointer:    size = sizeof(const void*); break;
+    case ArgType::Null:       size = sizeof(std::nullptr_t); break;
+    case ArgType::String: {
+        std::size_t length;
+        if (args.size() < sizeof(length)) return std::nullopt;
+        std::memcpy(&length, args.data(), sizeof(length));
+        if (length > args.size() - sizeof(length)) return std::nullopt;
+        size = sizeof(length) + length;
+        break;
+    }
+    case ArgType::Custom: {
+        u32 length;
+        std::memcpy(&length, type.data() + 1, sizeof(length));
+        size = length;
+        break;
+    }
+    default:
+        return std::nullopt;
+    }
+    if (size > args.size()) return std::nullopt;
+    return size;
+}
+
+template <typename T>
+void format_binary_arg(std::string& out, const std::string_view spec, const std::string_view bytes) {
+    T value{};
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        value = bytes.substr(sizeof(std::size_t));
+    } else {
+        std::memcpy(&value, bytes.data(), sizeof(T));
+    }
+    std::vformat_to(std::back_inserter(out), spec, std::make_format_args(value));
+}
+
+// Formats one encoded argument with a replacement field like "{:>8}"
+inline void format_binary_arg(std::string& out, const std::string_view spec, const std::string_view type,
+                              const std::string_view bytes) {
+    // clang-format off
+    switch (static_cast<ArgType>(type[0])) {
+    case ArgType::Bool:       format_binary_arg<bool>(out, spec, bytes); break;
+    case ArgType::Char:       format_binary_arg<char>(out, spec, bytes); break;
+    case ArgType::I8:         format_binary_arg<i8>(out, spec, bytes); break;
+    case ArgType::I16:        format_binary_arg<i16>(out, spec, bytes); break;
+    case ArgType::I32:        format_binary_arg<i32>(out, spec, bytes); break;
+    case ArgType::I64:        format_binary_arg<i64>(out, spec, bytes); break;
+    case ArgType::U8:         format_binary_arg<u8>(out, spec, bytes); break;
+    case ArgType::U16:        format_binary_arg<u16>(out, spec, bytes); break;
+    case ArgType::U32:        format_binary_arg<u32>(out, spec, bytes); break;
+    case ArgType::U64:        format_binary_arg<u64>(out, spec, bytes); break;
+    case ArgType::F32:        format_binary_arg<f32>(out, spec, bytes); break;
+    case ArgType::F64:        format_binary_arg<f64>(out, spec, bytes); break;
+    case ArgType::LongDouble: format_binary_arg<long double>(out, spec, bytes); break;
+    case ArgType::String:     format_binary_arg<std::string_view>(out, spec, bytes); break;
+    case ArgType::Pointer:    format_binary_arg<const void*>(out, spec, bytes); break;
+    case ArgType::Null:       format_binary_arg<std::nullptr_t>(out, spec, bytes); break;
+    case ArgType::Custom:     std::format_to(std::back_inserter(out), "<{} bytes>", bytes.size()); break;
+    default:                  break;
+    }
+    // clang-format on
+}
+
+// Walks the format string and formats every replacement field on its own, so arguments whose
+// types are only known at runtime still get their original format spec. Nested replacement
+// fields such as "{:{}}" are not supported and are copied as is.
+inline bool format_binary_message(std::string& out, const std::string_view fmt, std::string_view types,
+                                  std::string_view args) {
+    std::vector<std::pair<std::string_view, std::string_view>> decoded; // type, bytes
+    while (!types.empty()) {
+        const std::size_t type_size = static_cast<ArgType>(types[0]) == ArgType::Custom ? 5 : 1;
+        if (types.size() < type_size) return false;
+        const std::string_view type = types.substr(0, type_size);
+        const std::optional<std::size_t> size = binary_arg_size(type, args);
+        if (!size) return false;
+        decoded.emplace_back(type, args.substr(0, *size));
+        types.remove_prefix(type_size);
+        args.remove_prefix(*size);
+    }
+
+    std::size_t next_arg = 0;
+    std::string spec;
+    for (std::size_t i = 0; i < fmt.size(); ++i) {
+        const char c = fmt[i];
+        if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+            out += c;
+            ++i;
+            continue;
+        }
+        if (c != '{') {
+            out += c;
+            continue;
+        }
+
+        const std::size_t close = fmt.find('}', i);
+        const std::string_view field = fmt.substr(i + 1, close == std::string_view::npos ? close : close - i - 1);
+        if (close == std::string_view::npos || field.find('{') != std::string_view::npos) {
+            out += fmt.substr(i);
+            return true;
+        }
+
+        std::size_t index = next_arg;
+        std::size_t id_end = 0;
+        if (!field.empty() && field[0] >= '0' && field[0] <= '9') {
+            index = 0;
+            while (id_end < field.size() && field[id_end] >= '0' && field[id_end] <= '9') {
+                index = index * 10 + static_cast<std::size_t>(field[id_end++] - '0');
+            }
+        } else {
+            ++next_arg;
+        }
+
+        spec.assign("{");
+        spec += field.substr(id_end);
+        spec += '}';
+        if (index >= decoded.size()) {
+            out += fmt.substr(i, close - i + 1);
+        } else {
+            try {
+                format_binary_arg(out, spec, decoded[index].first, decoded[index].second);
+            } catch (const std::format_error&) {
+                out += fmt.substr(i, close - i + 1);
+            }
+        }
+        i = close;
+    }
+    return true;
+}
+
+} // namespace detail
+
+// Turns a file written through BinaryFileSink back into text lines and writes them to sink.
+// Lines look like the text output with a nanosecond timestamp in front.
+template <Sink S>
+std::expected<void, std::string> decode_binary(const std::string_view data, S& sink) {
+    struct Format {
+        LogLevel level;
+        u32 line;
+        std::string_view file;
+        std::string_view category;
+        std::string_view fmt;
+        std::string_view types;
+    };
+
+    detail::BinaryReader reader(data);
+    std::string_view magic;
+    u32 version;
+    if (!reader.read(magic, BinaryFileSink::magic.size()) || magic != BinaryFileSink::magic || !reader.read(version)) {
+        return std::unexpected("Not a binary log file");
+    }
+    if (version != BinaryFileSink::version) {
+        return std::unexpected(std::format("Unsupported binary log version {}", version));
+    }
+
+    std::unordered_map<u32, Format> formats;
+    detail::TimestampCache timestamps;
+    std::string line;
+
+    while (!reader.done()) {
+        u8 kind;
+        u32 id;
+        if (!reader.read(kind) || kind == static_cast<u8>(detail::BinaryRecord::End)) break;
+        if (!reader.read(id)) return std::unexpected("Truncated record");
+
+        if (kind == static_cast<u8>(detail::BinaryRecord::Format)) {
+            Format format{};
+            if (!reader.read(format.level) || !reader.read(format.line) || !reader.read_string(format.file) ||
+                !reader.read_string(format.category) || !reader.read_string(format.fmt) ||
+                !reader.read_string(format.types)) {
+                return std::unexpected("Truncated format record");
+            }
+            formats[id] = format;
+            continue;
+        }
+        if (kind != static_cast<u8>(detail::BinaryRecord::Log)) {
+            return std::unexpected(std::format("Unknown record kind {}", kind));
+        }
+
+        i64 timestamp;
+        std::string_view args;
+        if (!reader.read(timestamp) || !reader.read_string(args)) return std::unexpected("Truncated log record");
+
+        const auto it = formats.find(id);
+        if (it == formats.end()) return std::unexpected(std::format("Unknown format id {}", id));
+        const Format& format = it->second;
+
+        line.clear();
+        timestamps.append(line, timestamp, 9);
+        line += " [";
+        line += detail::to_string(format.level);
+        line += "] ";
+        if (!format.category.empty()) std::format_to(std::back_inserter(line), "[{}] ", format.category);
+        if (!format.file.empty()) std::format_to(std::back_inserter(line), "[{}:{}] ", format.file, format.line);
+        if (!detail::format_binary_message(line, format.fmt, format.types, args)) {
+            return std::unexpected(std::format("Malformed arguments for format id {}", id));
+        }
+        line += '\n';
+        sink.write(line);
+    }
+
+    sink.flush();
+    return {};
+}
+
+} // namespace utils::log
+
+// these names are very common but works for me
+
+// Calls below UTILS_LOG_MIN_LEVEL are discarded at compile time, the runtime level is checked
+// before the arguments are evaluated. Both are statements, not expressions.
+#define UTILS_LOG_AT(level, ...)                                                                                       \
+    do {                                                                                                               \
+        if constexpr ((level) >= utils::log::min_level) {                                                              \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(level)) utils_log_logger.log<level>(__VA_ARGS__);                             \
+        }                                                                                                              \
+    } while (false)
+
+#define DEBUG(fmt, ...)                                                                                                \
+    do {                                                                                                               \
+        if constexpr (utils::log::LogLevel::DEBUG >= utils::log::min_level) {                                         \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(utils::log::LogLevel::DEBUG)) {                                               \
+                utils_log_logger.debug(fmt, __FILE__, __LINE__ __VA_OPT__(, ) __VA_ARGS__);                            \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define INFO(...) UTILS_LOG_AT(utils::log::LogLevel::INFO, __VA_ARGS__)
+#define WARNING(...) UTILS_LOG_AT(utils::log::LogLevel::WARNING, __VA_ARGS__)
+#define ERROR(...) UTILS_LOG_AT(utils::log::LogLevel::ERROR, __VA_ARGS__)
+
+// Category variants, the category is looked up once per call site and cached in a static
+#define UTILS_LOG_CAT_AT(level, name, ...)                                                                             \
+    do {                                                                                                               \
+        if constexpr ((level) >= utils::log::min_level) {                                                              \
+            static const utils::log::Category& utils_log_category = utils::log::category(name);                       \
+            if (utils_log_category.enabled(level)) {                                                                   \
+                utils::log::detail::logger::instance().log<level>(utils_log_category, __VA_ARGS__);                    \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define DEBUG_CAT(name, fmt, ...)                                                                                      \
+    do {                                                                                                               \
+        if constexpr (utils::log::LogLevel::DEBUG >= utils::log::min_level) {                                         \
+            static const utils::log::Category& utils_log_category = utils::log::category(name);                       \
+            if (utils_log_category.enabled(utils::log::LogLevel::DEBUG)) {                                             \
+                utils::log::detail::logger::instance().debug(utils_log_category, fmt, __FILE__,                        \
+                                                             __LINE__ __VA_OPT__(, ) __VA_ARGS__);                     \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define INFO_CAT(name, ...) UTILS_LOG_CAT_AT(utils::log::LogLevel::INFO, name, __VA_ARGS__)
+#define WARNING_CAT(name, ...) UTILS_LOG_CAT_AT(utils::log::LogLevel::WARNING, name, __VA_ARGS__)
+#define ERROR_CAT(name, ...) UTILS_LOG_CAT_AT(utils::log::LogLevel::ERROR, name, __VA_ARGS__)
+
+// Structured variants taking a message and key-value pairs, e.g. INFO_KV("login", "user", id, "ms", ms)
+#define UTILS_LOG_KV_AT(level, ...)                                                                                    \
+    do {                                                                                                               \
+        if constexpr ((level) >= utils::log::min_level) {                                                              \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(level)) utils_log_logger.log_kv<level>(__VA_ARGS__);                          \
+        }                                                                                                              \
+    } while (false)
+
+#define DEBUG_KV(message, ...)                                                                                         \
+    do {                                                                                                               \
+        if constexpr (utils::log::LogLevel::DEBUG >= utils::log::min_level) {                                         \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(utils::log::LogLevel::DEBUG)) {                                               \
+                utils_log_logger.debug_kv(message, __FILE__, __LINE__ __VA_OPT__(, ) __VA_ARGS__);                     \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define INFO_KV(...) UTILS_LOG_KV_AT(utils::log::LogLevel::INFO, __VA_ARGS__)
+#define WARNING_KV(...) UTILS_LOG_KV_AT(utils::log::LogLevel::WARNING, __VA_ARGS__)
+#define ERROR_KV(...) UTILS_LOG_KV_AT(utils::log::LogLevel::ERROR, __VA_ARGS__)
+
+#define UTILS_LOG_CONCAT_IMPL(a, b) a##b
+#define UTILS_LOG_CONCAT(a, b) UTILS_LOG_CONCAT_IMPL(a, b)
+
+// Records the rest of the enclosing scope as a trace span, see set_trace_sink
+#define TRACE_SCOPE(name) const utils::log::TraceScope UTILS_LOG_CONCAT(utils_log_trace_scope_, __COUNTER__)(name)
+
+// Rate limited variants, e.g. ERROR_EVERY_N(1000, ...), INFO_FIRST_N(10, ...), WARNING_EVERY_MS(500, ...)
+// and DEBUG_SAMPLE(0.01, ...). The gate keeps its state per call site.
+#define UTILS_LOG_GATED_AT(level, gate, limit, ...)                                                                    \
+    do {                                                                                                               \
+        if constexpr ((level) >= utils::log::min_level) {                                                              \
+            static utils::log::detail::gate utils_log_gate;                                                            \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(level) && utils_log_gate(limit)) utils_log_logger.log<level>(__VA_ARGS__);    \
+        }                                                                                                              \
+    } while (false)
+
+#define UTILS_LOG_GATED_DEBUG(gate, limit, fmt, ...)                                                                   \
+    do {                                                                                                               \
+        if constexpr (utils::log::LogLevel::DEBUG >= utils::log::min_level) {                                         \
+            static utils::log::detail::gate utils_log_gate;                                                            \
+            auto& utils_log_logger = utils::log::detail::logger::instance();                                           \
+            if (utils_log_logger.enabled(utils::log::LogLevel::DEBUG) && utils_log_gate(limit)) {                      \
+                utils_log_logger.debug(fmt, __FILE__, __LINE__ __VA_OPT__(, ) __VA_ARGS__);                            \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (false)
+
+#define DEBUG_EVERY_N(n, ...) UTILS_LOG_GATED_DEBUG(EveryN, n, __VA_ARGS__)
+#define INFO_EVERY_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::INFO, EveryN, n, __VA_ARGS__)
+#define WARNING_EVERY_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::WARNING, EveryN, n, __VA_ARGS__)
+#define ERROR_EVERY_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::ERROR, EveryN, n, __VA_ARGS__)
+
+#define DEBUG_FIRST_N(n, ...) UTILS_LOG_GATED_DEBUG(FirstN, n, __VA_ARGS__)
+#define INFO_FIRST_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::INFO, FirstN, n, __VA_ARGS__)
+#define WARNING_FIRST_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::WARNING, FirstN, n, __VA_ARGS__)
+#define ERROR_FIRST_N(n, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::ERROR, FirstN, n, __VA_ARGS__)
+
+#define DEBUG_EVERY_MS(ms, ...) UTILS_LOG_GATED_DEBUG(EveryMs, ms, __VA_ARGS__)
+#define INFO_EVERY_MS(ms, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::INFO, EveryMs, ms, __VA_ARGS__)
+#define WARNING_EVERY_MS(ms, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::WARNING, EveryMs, ms, __VA_ARGS__)
+#define ERROR_EVERY_MS(ms, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::ERROR, EveryMs, ms, __VA_ARGS__)
+
+#define DEBUG_SAMPLE(p, ...) UTILS_LOG_GATED_DEBUG(Sample, p, __VA_ARGS__)
+#define INFO_SAMPLE(p, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::INFO, Sample, p, __VA_ARGS__)
+#define WARNING_SAMPLE(p, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::WARNING, Sample, p, __VA_ARGS__)
+#define ERROR_SAMPLE(p, ...) UTILS_LOG_GATED_AT(utils::log::LogLevel::ERROR, Sample, p, __VA_ARGS__)
 
 #endif // UTILS_LOG_HPP
@@ -11,10 +11,73 @@
 
 #include "common.hpp"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <charconv>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <expected>
+#include <format>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // _WIN32
+
+// Byte scanning kernels use the widest vector unit enabled at compile time
+#if defined(__AVX2__)
+#define UTILS_STRING_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTILS_STRING_SSE2 1
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define UTILS_STRING_NEON 1
+#endif
+
+#if defined(UTILS_STRING_AVX2) || defined(UTILS_STRING_SSE2)
+#include <immintrin.h>
+#elif defined(UTILS_STRING_NEON)
+#include <arm_neon.h>
+#endif
+
+#if defined(UTILS_STRING_AVX2) || defined(UTILS_STRING_SSE2) || defined(UTILS_STRING_NEON)
+#define UTILS_STRING_SIMD 1
+#else
+#define UTILS_STRING_SIMD 0
+#endif
+
+// Without -mavx2, the block classifiers check for AVX2 once at runtime
+#if defined(UTILS_STRING_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#define UTILS_STRING_DISPATCH_AVX2 1
+#define UTILS_STRING_TARGET_AVX2
+#elif defined(UTILS_STRING_SSE2) && defined(__GNUC__)
+#define UTILS_STRING_DISPATCH_AVX2 1
+#define UTILS_STRING_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define UTILS_STRING_TARGET_AVX2
+#endif
+
 namespace utils::string {
 
 enum class TrimMode : u8 { Left, Right, Both };
@@ -95,6 +158,387 @@ constexpr std::size_t strnlen(const char* str, const std::size_t max = 1024) {
 
 namespace detail {
 
+#if UTILS_STRING_SIMD
+namespace simd {
+
+// A mask has one bit set per matching byte, in a field of mask_bits bits per byte, lowest byte first
+#if defined(UTILS_STRING_AVX2)
+using Vec = __m256i;
+inline constexpr std::size_t width = 32;
+inline constexpr int mask_bits = 1;
+
+inline Vec load(const char* p) noexcept {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+inline Vec splat(const char c) noexcept {
+    return _mm256_set1_epi8(c);
+}
+
+inline Vec eq(const Vec a, const Vec b) noexcept {
+    return _mm256_cmpeq_epi8(a, b);
+}
+
+inline u64 mask(const Vec v) noexcept {
+    return static_cast<u32>(_mm256_movemask_epi8(v));
+}
+
+inline void store(char* p, const Vec v) noexcept {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+inline Vec bit_or(const Vec a, const Vec b) noexcept {
+    return _mm256_or_si256(a, b);
+}
+
+inline Vec bit_and(const Vec a, const Vec b) noexcept {
+    return _mm256_and_si256(a, b);
+}
+
+inline Vec bit_xor(const Vec a, const Vec b) noexcept {
+    return _mm256_xor_si256(a, b);
+}
+
+// lo <= v <= hi as unsigned bytes, v - lo wraps around for bytes below lo
+inline Vec in_range(const Vec v, const char lo, const char hi) noexcept {
+    const Vec offset = _mm256_sub_epi8(v, splat(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, splat(static_cast<char>(hi - lo))), offset);
+}
+#elif defined(UTILS_STRING_SSE2)
+using Vec = __m128i;
+inline constexpr std::size_t width = 16;
+inline constexpr int mask_bits = 1;
+
+inline Vec load(const char* p) noexcept {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+inline Vec splat(const char c) noexcept {
+    return _mm_set1_epi8(c);
+}
+
+inline Vec eq(const Vec a, const Vec b) noexcept {
+    return _mm_cmpeq_epi8(a, b);
+}
+
+inline u64 mask(const Vec v) noexcept {
+    return static_cast<u32>(_mm_movemask_epi8(v));
+}
+
+inline void store(char* p, const Vec v) noexcept {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+inline Vec bit_or(const Vec a, const Vec b) noexcept {
+    return _mm_or_si128(a, b);
+}
+
+inline Vec bit_and(const Vec a, const Vec b) noexcept {
+    return _mm_and_si128(a, b);
+}
+
+inline Vec bit_xor(const Vec a, const Vec b) noexcept {
+    return _mm_xor_si128(a, b);
+}
+
+// lo <= v <= hi as unsigned bytes, v - lo wraps around for bytes below lo
+inline Vec in_range(const Vec v, const char lo, const char hi) noexcept {
+    const Vec offset = _mm_sub_epi8(v, splat(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, splat(static_cast<char>(hi - lo))), offset);
+}
+#elif defined(UTILS_STRING_NEON)
+using Vec = uint8x16_t;
+inline constexpr std::size_t width = 16;
+inline constexpr int mask_bits = 4;
+
+inline Vec load(const char* p) noexcept {
+    return vld1q_u8(reinterpret_cast<const u8*>(p));
+}
+
+inline Vec splat(const char c) noexcept {
+    return vdupq_n_u8(static_cast<u8>(c));
+}
+
+inline Vec eq(const Vec a, const Vec b) noexcept {
+    return vceqq_u8(a, b);
+}
+
+// NEON has no movemask, narrowing each 16-bit lane by 4 keeps a nibble per byte and one bit of it is kept
+inline u64 mask(const Vec v) noexcept {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0) & 0x8888888888888888ULL;
+}
+
+inline void store(char* p, const Vec v) noexcept {
+    vst1q_u8(reinterpret_cast<u8*>(p), v);
+}
+
+inline Vec bit_or(const Vec a, const Vec b) noexcept {
+    return vorrq_u8(a, b);
+}
+
+inline Vec bit_and(const Vec a, const Vec b) noexcept {
+    return vandq_u8(a, b);
+}
+
+inline Vec bit_xor(const Vec a, const Vec b) noexcept {
+    return veorq_u8(a, b);
+}
+
+// lo <= v <= hi as unsigned bytes, v - lo wraps around for bytes below lo
+inline Vec in_range(const Vec v, const char lo, const char hi) noexcept {
+    return vcleq_u8(vsubq_u8(v, splat(lo)), splat(static_cast<char>(hi - lo)));
+}
+#endif
+
+// Mask with every byte of a vector set
+inline constexpr u64 full = mask_bits == 1 ? (u64{1} << width) - 1 : 0x8888888888888888ULL;
+
+// Index of the first byte set in a non-zero mask
+inline std::size_t first_index(const u64 m) noexcept {
+    return static_cast<std::size_t>(std::countr_zero(m) / mask_bits);
+}
+
+// Block classifiers look at 64 bytes at once and return one bit per byte, bit i for p[i]
+inline constexpr std::size_t block = 64;
+
+struct SpaceMasks {
+    u64 space; // ascii::is_space
+    u64 blank; // ' ' only
+};
+
+#if defined(UTILS_STRING_AVX2) || defined(UTILS_STRING_DISPATCH_AVX2)
+// The whitespace bytes all have different low nibbles, so looking up the low nibble of every byte
+// in a table holding them gives back the byte itself only for whitespace. vpshufb returns 0 for
+// bytes with the high bit set, which never equals such a byte either
+UTILS_STRING_TARGET_AVX2 inline SpaceMasks space_masks_avx2(const char* p) noexcept {
+    const __m256i table = _mm256_setr_epi8(' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0, //
+                                           ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0);
+    const __m256i blank = _mm256_set1_epi8(' ');
+    SpaceMasks result{0, 0};
+    for (std::size_t i = 0; i < block; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        const auto space = static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_shuffle_epi8(table, v), v)));
+        const auto blanks = static_cast<u32>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, blank)));
+        result.space |= u64{space} << i;
+        result.blank |= u64{blanks} << i;
+    }
+    return result;
+}
+#endif
+
+#if defined(UTILS_STRING_SSE2)
+// SSE2 has no byte shuffle, '\t'..'\r' is a single range check on v - '\t' instead
+inline SpaceMasks space_masks_sse2(const char* p) noexcept {
+    const __m128i blank = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i range = _mm_set1_epi8('\r' - '\t');
+    SpaceMasks result{0, 0};
+    for (std::size_t i = 0; i < block; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        const __m128i offset = _mm_sub_epi8(v, tab);
+        const __m128i is_blank = _mm_cmpeq_epi8(v, blank);
+        const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(offset, range), offset);
+        result.space |= u64{static_cast<u32>(_mm_movemask_epi8(_mm_or_si128(is_blank, in_range)))} << i;
+        result.blank |= u64{static_cast<u32>(_mm_movemask_epi8(is_blank))} << i;
+    }
+    return result;
+}
+
+inline bool has_avx2() noexcept {
+    static const bool result = [] {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        constexpr int osxsave_avx = (1 << 27) | (1 << 28);
+        if ((info[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return result;
+}
+#endif // UTILS_STRING_SSE2
+
+#if defined(UTILS_STRING_NEON)
+// Packs 4 comparison results into one bit per byte
+inline u64 to_bits(const uint8x16_t m0, const uint8x16_t m1, const uint8x16_t m2, const uint8x16_t m3) noexcept {
+    constexpr u8 weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t bits = vld1q_u8(weights);
+    uint8x16_t sum = vpaddq_u8(vpaddq_u8(vandq_u8(m0, bits), vandq_u8(m1, bits)),
+                               vpaddq_u8(vandq_u8(m2, bits), vandq_u8(m3, bits)));
+    sum = vpaddq_u8(sum, sum);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(sum), 0);
+}
+
+// Same table lookup as the AVX2 version, tbl needs the index masked to the low nibble
+inline SpaceMasks space_masks_neon(const char* p) noexcept {
+    constexpr u8 whitespace[16] = { ' ', 0, 0, 0, 0, 0, 0, 0, 0, '\t', '\n', '\v', '\f', '\r', 0, 0 };
+    const uint8x16_t table = vld1q_u8(whitespace);
+    const uint8x16_t low = vdupq_n_u8(0x0F);
+    const uint8x16_t blank = vdupq_n_u8(' ');
+    uint8x16_t space[4];
+    uint8x16_t blanks[4];
+    for (std::size_t i = 0; i < 4; ++i) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const u8*>(p + i * 16));
+        space[i] = vceqq_u8(vqtbl1q_u8(table, vandq_u8(v, low)), v);
+        blanks[i] = vceqq_u8(v, blank);
+    }
+    return { to_bits(space[0], space[1], space[2], space[3]), to_bits(blanks[0], blanks[1], blanks[2], blanks[3]) };
+}
+#endif // UTILS_STRING_NEON
+
+inline SpaceMasks space_masks(const char* p) noexcept {
+#if defined(UTILS_STRING_AVX2)
+    return space_masks_avx2(p);
+#elif defined(UTILS_STRING_DISPATCH_AVX2)
+    return has_avx2() ? space_masks_avx2(p) : space_masks_sse2(p);
+#elif defined(UTILS_STRING_SSE2)
+    return space_masks_sse2(p);
+#else
+    return space_masks_neon(p);
+#endif
+}
+
+} // namespace simd
+#endif // UTILS_STRING_SIMD
+
+// Position of the first c at or after pos, or npos
+constexpr std::size_t find_byte(const std::string_view str, const char c, std::size_t pos = 0) noexcept {
+    if !consteval {
+#if UTILS_STRING_SIMD
+        const simd::Vec needle = simd::splat(c);
+        for (; pos + simd::width <= str.size(); pos += simd::width) {
+            const u64 m = simd::mask(simd::eq(simd::load(str.data() + pos), needle));
+            if (m != 0) return pos + simd::first_index(m);
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    for (; pos < str.size(); ++pos) {
+        if (str[pos] == c) return pos;
+    }
+    return std::string_view::npos;
+}
+
+// Compares the first and the last byte of needle at a vector of positions at once, only positions
+// where both match are compared in full
+constexpr std::size_t find_substring(const std::string_view str, const std::string_view needle,
+                                     std::size_t pos) noexcept {
+    if !consteval {
+#if UTILS_STRING_SIMD
+        const std::size_t last = needle.size() - 1;
+        const simd::Vec first_byte = simd::splat(needle.front());
+        const simd::Vec last_byte = simd::splat(needle.back());
+        for (; pos + last + simd::width <= str.size(); pos += simd::width) {
+            const u64 first_mask = simd::mask(simd::eq(simd::load(str.data() + pos), first_byte));
+            const u64 last_mask = simd::mask(simd::eq(simd::load(str.data() + pos + last), last_byte));
+            for (u64 m = first_mask & last_mask; m != 0; m &= m - 1) {
+                const std::size_t candidate = pos + simd::first_index(m);
+                if (last == 1 ||
+                    std::char_traits<char>::compare(str.data() + candidate + 1, needle.data() + 1, last - 1) == 0) {
+                    return candidate;
+                }
+            }
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    return str.find(needle, pos);
+}
+
+constexpr std::size_t find(const std::string_view str, const std::string_view needle, const std::size_t pos) noexcept {
+    if (needle.size() == 1) return find_byte(str, needle[0], pos);
+    if (needle.empty()) return str.find(needle, pos);
+    return find_substring(str, needle, pos);
+}
+
+// Calls on_match with the position of every c in str, in order. Every vector is scanned once
+// however many matches it holds, which matters for short tokens
+template <typename F>
+constexpr void for_each_byte(const std::string_view str, const char c, F&& on_match) {
+    std::size_t pos = 0;
+    if !consteval {
+#if UTILS_STRING_SIMD
+        const simd::Vec needle = simd::splat(c);
+        for (; pos + simd::width <= str.size(); pos += simd::width) {
+            for (u64 m = simd::mask(simd::eq(simd::load(str.data() + pos), needle)); m != 0; m &= m - 1) {
+                on_match(pos + simd::first_index(m));
+            }
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    for (; pos < str.size(); ++pos) {
+        if (str[pos] == c) on_match(pos);
+    }
+}
+
+// Calls on_match with the position of every non-overlapping needle in str, left to right, with the
+// same filter as find_substring. on_match may write to str below the position after the match
+template <typename F>
+constexpr void for_each_substring(const std::string_view str, const std::string_view needle, F&& on_match) {
+    std::size_t pos = 0;
+    if !consteval {
+#if UTILS_STRING_SIMD
+        const std::size_t last = needle.size() - 1;
+        const simd::Vec first_byte = simd::splat(needle.front());
+        const simd::Vec last_byte = simd::splat(needle.back());
+        std::size_t block = 0;
+        for (; block + last + simd::width <= str.size(); block += simd::width) {
+            const u64 first_mask = simd::mask(simd::eq(simd::load(str.data() + block), first_byte));
+            const u64 last_mask = simd::mask(simd::eq(simd::load(str.data() + block + last), last_byte));
+            for (u64 m = first_mask & last_mask; m != 0; m &= m - 1) {
+                const std::size_t candidate = block + simd::first_index(m);
+                if (candidate < pos) continue;
+                if (last == 1 ||
+                    std::char_traits<char>::compare(str.data() + candidate + 1, needle.data() + 1, last - 1) == 0) {
+                    on_match(candidate);
+                    pos = candidate + needle.size();
+                }
+            }
+        }
+        if (pos < block) pos = block;
+#endif // UTILS_STRING_SIMD
+    }
+    for (; (pos = str.find(needle, pos)) != std::string_view::npos; pos += needle.size()) on_match(pos);
+}
+
+// Non-empty needles only
+template <typename F>
+constexpr void for_each_match(const std::string_view str, const std::string_view needle, F&& on_match) {
+    if (needle.size() == 1) {
+        for_each_byte(str, needle[0], on_match);
+    } else {
+        for_each_substring(str, needle, on_match);
+    }
+}
+
+// Calls on_token for every token of str in order, without copying
+template <typename F>
+constexpr void for_each_token(const std::string_view str, const std::string_view delimiter,
+                              const SplitBehavior behavior, F&& on_token) {
+    if (delimiter.empty()) {
+        on_token(str);
+        return;
+    }
+
+    std::size_t token_start = 0;
+    const auto emit = [&](const std::size_t end) {
+        if (behavior == SplitBehavior::KeepEmpty || end != token_start) {
+            on_token(str.substr(token_start, end - token_start));
+        }
+        token_start = end + delimiter.size();
+    };
+
+    for_each_match(str, delimiter, emit);
+
+    if (behavior == SplitBehavior::KeepEmpty || token_start != str.size()) {
+        on_token(str.substr(token_start));
+    }
+}
+
 constexpr std::string_view to_view(const char* str) {
     ASSERT(str != nullptr);
     ASSERT(strnlen(str) < 1024);
@@ -113,20 +557,320 @@ constexpr char* copy(const char* begin, const char* end, char* result) {
     return result;
 }
 
-constexpr void trim_left_in_place(std::string& str) {
-    std::size_t start = 0;
-    while (start < str.size() && ascii::is_space(str[start])) ++start;
-    str.erase(0, start);
+// Length of the leading whitespace
+constexpr std::size_t first_non_space(const std::string_view str) noexcept {
+    std::size_t pos = 0;
+    if !consteval {
+#if UTILS_STRING_SIMD
+        for (; pos + simd::block <= str.size(); pos += simd::block) {
+            const u64 m = ~simd::space_masks(str.data() + pos).space;
+            if (m != 0) return pos + static_cast<std::size_t>(std::countr_zero(m));
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    while (pos < str.size() && ascii::is_space(str[pos])) ++pos;
+    return pos;
 }
 
-constexpr void trim_right_in_place(std::string& str) {
+// Length of str without its trailing whitespace
+constexpr std::size_t last_non_space_end(const std::string_view str) noexcept {
     std::size_t end = str.size();
+    if !consteval {
+#if UTILS_STRING_SIMD
+        for (; end >= simd::block; end -= simd::block) {
+            const u64 m = ~simd::space_masks(str.data() + end - simd::block).space;
+            if (m != 0) return end - static_cast<std::size_t>(std::countl_zero(m));
+        }
+#endif // UTILS_STRING_SIMD
+    }
     while (end > 0 && ascii::is_space(str[end - 1])) --end;
-    str.erase(end);
+    return end;
+}
+
+constexpr void trim_left_in_place(std::string& str) {
+    str.erase(0, first_non_space(str));
+}
+
+constexpr void trim_right_in_place(std::string& str) {
+    str.erase(last_non_space_end(str));
+}
+
+// Byte classes, each with the scalar predicate from ascii and the same test on a whole vector
+struct Digit {
+    static constexpr bool test(const char c) noexcept {
+        return ascii::is_digit(c);
+    }
+#if UTILS_STRING_SIMD
+    static simd::Vec test(const simd::Vec v) noexcept {
+        return simd::in_range(v, '0', '9');
+    }
+#endif
+};
+
+// Setting 0x20 maps 'A'..'Z' onto 'a'..'z' and nothing else onto them
+struct Alpha {
+    static constexpr bool test(const char c) noexcept {
+        return ascii::is_alpha(c);
+    }
+#if UTILS_STRING_SIMD
+    static simd::Vec test(const simd::Vec v) noexcept {
+        return simd::in_range(simd::bit_or(v, simd::splat(0x20)), 'a', 'z');
+    }
+#endif
+};
+
+struct Alnum {
+    static constexpr bool test(const char c) noexcept {
+        return ascii::is_alnum(c);
+    }
+#if UTILS_STRING_SIMD
+    static simd::Vec test(const simd::Vec v) noexcept {
+        return simd::bit_or(Alpha::test(v), Digit::test(v));
+    }
+#endif
+};
+
+struct HexDigit {
+    static constexpr bool test(const char c) noexcept {
+        return ascii::is_hex_digit(c);
+    }
+#if UTILS_STRING_SIMD
+    static simd::Vec test(const simd::Vec v) noexcept {
+        return simd::bit_or(Digit::test(v), simd::in_range(simd::bit_or(v, simd::splat(0x20)), 'a', 'f'));
+    }
+#endif
+};
+
+struct Space {
+    static constexpr bool test(const char c) noexcept {
+        return ascii::is_space(c);
+    }
+#if UTILS_STRING_SIMD
+    static simd::Vec test(const simd::Vec v) noexcept {
+        return simd::bit_or(simd::eq(v, simd::splat(' ')), simd::in_range(v, '\t', '\r'));
+    }
+#endif
+};
+
+template <typename Class>
+constexpr std::size_t find_first_not(const std::string_view str) noexcept {
+    std::size_t pos = 0;
+    if !consteval {
+#if UTILS_STRING_SIMD
+        for (; pos + simd::width <= str.size(); pos += simd::width) {
+            const u64 m = simd::mask(Class::test(simd::load(str.data() + pos))) ^ simd::full;
+            if (m != 0) return pos + simd::first_index(m);
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    for (; pos < str.size(); ++pos) {
+        if (!Class::test(str[pos])) return pos;
+    }
+    return std::string_view::npos;
+}
+
+// Flips 0x20 on the letters of the other case
+template <bool Upper>
+constexpr void convert_case(const std::string_view str, char* out) noexcept {
+    std::size_t pos = 0;
+    if !consteval {
+#if UTILS_STRING_SIMD
+        const simd::Vec case_bit = simd::splat(0x20);
+        for (; pos + simd::width <= str.size(); pos += simd::width) {
+            const simd::Vec v = simd::load(str.data() + pos);
+            const simd::Vec letters = Upper ? simd::in_range(v, 'a', 'z') : simd::in_range(v, 'A', 'Z');
+            simd::store(out + pos, simd::bit_xor(v, simd::bit_and(letters, case_bit)));
+        }
+#endif // UTILS_STRING_SIMD
+    }
+    for (; pos < str.size(); ++pos) out[pos] = Upper ? ascii::to_upper(str[pos]) : ascii::to_lower(str[pos]);
+}
+
+template <typename T>
+inline T load_little_endian(const char* p) noexcept {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) value = std::byteswap(value);
+    return value;
+}
+
+// The first size (at most 8) bytes as a little endian word, zero padded. The same on every platform,
+// so hashes match at compile time. Short tails are read with overlapping loads instead of a loop
+constexpr u64 load_word(const char* p, const std::size_t size = 8) noexcept {
+    if !consteval {
+        if (size == 8) return load_little_endian<u64>(p);
+        if (size >= 4) {
+            const u64 low = load_little_endian<u32>(p);
+            const u64 high = load_little_endian<u32>(p + size - 4);
+            return low | (high << (8 * (size - 4)));
+        }
+        if (size == 0) return 0;
+        return u64{ static_cast<u8>(p[0]) } | (u64{ static_cast<u8>(p[size / 2]) } << (8 * (size / 2))) |
+               (u64{ static_cast<u8>(p[size - 1]) } << (8 * (size - 1)));
+    }
+    u64 word = 0;
+    for (std::size_t i = 0; i < size; ++i) word |= u64{ static_cast<u8>(p[i]) } << (8 * i);
+    return word;
+}
+
+// ascii::to_lower on every byte of a word. A byte is upper case when its low 7 bits are in 'A'..'Z'
+// and its high bit is clear, the additions cannot carry into the next byte
+constexpr u64 fold_case(const u64 word) noexcept {
+    constexpr u64 ones = 0x0101010101010101ULL;
+    const u64 low_bits = word & (0x7F * ones);
+    const u64 at_least_a = low_bits + (0x80 - 'A') * ones;
+    const u64 above_z = low_bits + (0x80 - 'Z' - 1) * ones;
+    const u64 upper = at_least_a & ~above_z & ~word & (0x80 * ones);
+    return word | (upper >> 2);
+}
+
+// Finalizer of MurmurHash3
+constexpr u64 mix(u64 h) noexcept {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Two independent lanes of 8 bytes each per step, the length seeds the first one
+template <bool FoldCase>
+constexpr u64 hash_bytes(const std::string_view str) noexcept {
+    u64 h0 = 0x9e3779b97f4a7c15ULL ^ str.size();
+    u64 h1 = 0xc2b2ae3d27d4eb4fULL;
+    const auto step = [](const u64 h, const u64 word, const u64 k, const int r) {
+        return std::rotl((h ^ (FoldCase ? fold_case(word) : word)) * k, r);
+    };
+
+    std::size_t pos = 0;
+    for (; pos + 16 <= str.size(); pos += 16) {
+        h0 = step(h0, load_word(str.data() + pos), 0x87c37b91114253d5ULL, 31);
+        h1 = step(h1, load_word(str.data() + pos + 8), 0x4cf5ad432745937fULL, 33);
+    }
+    if (pos + 8 <= str.size()) {
+        h0 = step(h0, load_word(str.data() + pos), 0x87c37b91114253d5ULL, 31);
+        pos += 8;
+    }
+    if (pos < str.size()) {
+        h1 = step(h1, load_word(str.data() + pos, str.size() - pos), 0x4cf5ad432745937fULL, 33);
+    }
+    return mix(h0 ^ mix(h1));
 }
 
 } // namespace detail
 
+namespace ascii {
+
+// Bulk versions of the predicates above, a vector of bytes at a time. Positions are npos when every
+// byte is in the class
+constexpr std::size_t find_first_non_alpha(const std::string_view str) noexcept {
+    return detail::find_first_not<detail::Alpha>(str);
+}
+
+constexpr std::size_t find_first_non_digit(const std::string_view str) noexcept {
+    return detail::find_first_not<detail::Digit>(str);
+}
+
+constexpr std::size_t find_first_non_alnum(const std::string_view str) noexcept {
+    return detail::find_first_not<detail::Alnum>(str);
+}
+
+constexpr std::size_t find_first_non_hex_digit(const std::string_view str) noexcept {
+    return detail::find_first_not<detail::HexDigit>(str);
+}
+
+constexpr std::size_t find_first_non_space(const std::string_view str) noexcept {
+    return detail::find_first_not<detail::Space>(str);
+}
+
+constexpr bool all_of_alpha(const std::string_view str) noexcept {
+    return find_first_non_alpha(str) == std::string_view::npos;
+}
+
+constexpr bool all_of_digit(const std::string_view str) noexcept {
+    return find_first_non_digit(str) == std::string_view::npos;
+}
+
+constexpr bool all_of_alnum(const std::string_view str) noexcept {
+    return find_first_non_alnum(str) == std::string_view::npos;
+}
+
+constexpr bool all_of_hex_digit(const std::string_view str) noexcept {
+    return find_first_non_hex_digit(str) == std::string_view::npos;
+}
+
+constexpr bool all_of_space(const std::string_view str) noexcept {
+    return find_first_non_space(str) == std::string_view::npos;
+}
+
+// Writes str.size() bytes to out, which may be str.data() itself but must not overlap it otherwise
+constexpr void to_lower(const std::string_view str, char* out) noexcept {
+    detail::convert_case<false>(str, out);
+}
+
+constexpr void to_upper(const std::string_view str, char* out) noexcept {
+    detail::convert_case<true>(str, out);
+}
+
+constexpr void to_lower_in_place(std::string& str) noexcept {
+    to_lower(str, str.data());
+}
+
+constexpr void to_upper_in_place(std::string& str) noexcept {
+    to_upper(str, str.data());
+}
+
+} // namespace ascii
+
+// ASCII case-insensitive comparisons, 8 bytes at a time with the case folded inside a word
+constexpr bool iequals(const std::string_view lhs, const std::string_view rhs) noexcept {
+    if (lhs.size() != rhs.size()) return false;
+    std::size_t pos = 0;
+    for (; pos + 8 <= lhs.size(); pos += 8) {
+        if (detail::fold_case(detail::load_word(lhs.data() + pos)) !=
+            detail::fold_case(detail::load_word(rhs.data() + pos))) {
+            return false;
+        }
+    }
+    const std::size_t rest = lhs.size() - pos;
+    return detail::fold_case(detail::load_word(lhs.data() + pos, rest)) ==
+           detail::fold_case(detail::load_word(rhs.data() + pos, rest));
+}
+
+// Orders like comparing the ascii::to_lower copies as unsigned bytes
+constexpr std::strong_ordering icompare(const std::string_view lhs, const std::string_view rhs) noexcept {
+    const std::size_t size = lhs.size() < rhs.size() ? lhs.size() : rhs.size();
+    for (std::size_t pos = 0; pos < size; pos += 8) {
+        const std::size_t length = size - pos < 8 ? size - pos : 8;
+        const u64 a = detail::fold_case(detail::load_word(lhs.data() + pos, length));
+        const u64 b = detail::fold_case(detail::load_word(rhs.data() + pos, length));
+        if (a != b) {
+            const int shift = std::countr_zero(a ^ b) & ~7;
+            return static_cast<u8>(a >> shift) <=> static_cast<u8>(b >> shift);
+        }
+    }
+    return lhs.size() <=> rhs.size();
+}
+
+// Transparent hash and equality for case-insensitive keys, e.g.
+// std::unordered_map<std::string, V, ihash, iequal_to> can be searched with a string_view
+struct ihash {
+    using is_transparent = void;
+
+    constexpr std::size_t operator()(const std::string_view str) const noexcept {
+        return detail::hash_bytes<true>(str);
+    }
+};
+
+struct iequal_to {
+    using is_transparent = void;
+
+    constexpr bool operator()(const std::string_view lhs, const std::string_view rhs) const noexcept {
+        return iequals(lhs, rhs);
+    }
+};
+
 constexpr void trim_in_place(std::string& str, const TrimMode mode = TrimMode::Both) {
     if (mode == TrimMode::Left || mode == TrimMode::Both) {
         detail::trim_left_in_place(str);
@@ -141,26 +885,48 @@ constexpr std::string trim(std::string str, const TrimMode mode = TrimMode::Both
     return str;
 }
 
+constexpr std::string_view trim_view(const std::string_view str, const TrimMode mode = TrimMode::Both) noexcept {
+    const std::size_t start = mode == TrimMode::Right ? 0 : detail::first_non_space(str);
+    const std::size_t end = mode == TrimMode::Left ? str.size() : detail::last_non_space_end(str);
+    return start < end ? str.substr(start, end - start) : str.substr(start, 0);
+}
+
 constexpr void trim_and_reduce_in_place(std::string& str) {
-    std::size_t read = 0;
+    std::size_t read = detail::first_non_space(str);
     std::size_t write = 0;
     bool in_ws_seq = false;
 
-    while (read < str.size() && ascii::is_space(str[read])) ++read;
-
-    while (read < str.size()) {
-        if (ascii::is_space(str[read])) {
+    const auto step = [&](const char c) {
+        if (ascii::is_space(c)) {
             if (!in_ws_seq) {
                 str[write++] = ' ';
                 in_ws_seq = true;
             }
         } else {
-            str[write++] = str[read];
+            str[write++] = c;
             in_ws_seq = false;
         }
-        ++read;
+    };
+
+    if !consteval {
+#if UTILS_STRING_SIMD
+        // Blocks where every whitespace is a single ' ' are already reduced and moved as a whole
+        for (; read + detail::simd::block <= str.size(); read += detail::simd::block) {
+            const auto [space, blank] = detail::simd::space_masks(str.data() + read);
+            const u64 after_space = (space << 1) | u64{ in_ws_seq };
+            if ((space & (~blank | after_space)) == 0) {
+                if (write != read) std::memmove(str.data() + write, str.data() + read, detail::simd::block);
+                write += detail::simd::block;
+                in_ws_seq = (space >> 63) != 0;
+            } else {
+                for (std::size_t i = 0; i < detail::simd::block; ++i) step(str[read + i]);
+            }
+        }
+#endif // UTILS_STRING_SIMD
     }
 
+    for (; read < str.size(); ++read) step(str[read]);
+
     while (write > 0 && ascii::is_space(str[write - 1])) --write;
     str.resize(write);
 }
@@ -170,12 +936,48 @@ constexpr std::string trim_and_reduce(std::string str) {
     return str;
 }
 
+// Replaces every non-overlapping occurrence of from, left to right. The result is sized once, so the
+// cost stays linear however many matches there are. An empty from leaves str unchanged
 constexpr void replace_all_in_place(std::string& str, const std::string_view from, const std::string_view to) {
-    std::size_t pos = 0;
-    while ((pos = str.find(from, pos)) != std::string::npos) {
-        str.replace(pos, from.size(), to);
-        pos += to.size();
+    if (from.empty()) return;
+
+    if (to.size() == from.size()) {
+        detail::for_each_match(str, from, [&](const std::size_t pos) {
+            std::char_traits<char>::copy(str.data() + pos, to.data(), to.size());
+        });
+        return;
     }
+
+    if (to.size() < from.size()) {
+        // The output never overtakes the input, so segments are moved down in place
+        std::size_t write = 0;
+        std::size_t read = 0;
+        detail::for_each_match(str, from, [&](const std::size_t pos) {
+            std::char_traits<char>::move(str.data() + write, str.data() + read, pos - read);
+            write += pos - read;
+            std::char_traits<char>::copy(str.data() + write, to.data(), to.size());
+            write += to.size();
+            read = pos + from.size();
+        });
+        std::char_traits<char>::move(str.data() + write, str.data() + read, str.size() - read);
+        str.resize(write + str.size() - read);
+        return;
+    }
+
+    std::size_t count = 0;
+    detail::for_each_match(str, from, [&count](std::size_t) { ++count; });
+    if (count == 0) return;
+
+    std::string result;
+    result.reserve(str.size() + count * (to.size() - from.size()));
+    std::size_t read = 0;
+    detail::for_each_match(str, from, [&](const std::size_t pos) {
+        result.append(str, read, pos - read);
+        result.append(to);
+        read = pos + from.size();
+    });
+    result.append(str, read);
+    str = MOVE(result);
 }
 
 constexpr std::string replace_all(std::string str, const std::string_view from, const std::string_view to) {
@@ -183,29 +985,671 @@ constexpr std::string replace_all(std::string str, const std::string_view from,
     return str;
 }
 
-constexpr std::vector<std::string> split(const std::string_view str, const std::string_view delimiter,
-                                         const SplitBehavior behavior = SplitBehavior::Nothing) {
-    if (delimiter.empty()) return { std::string(str) };
+// Replaces several patterns in a single pass with an Aho-Corasick automaton. Among matches the leftmost
+// one wins, then the longest, and replaced text is not searched again. Build it once and reuse it,
+// construction is linear in the total pattern length times the number of distinct pattern bytes
+class Replacer {
+public:
+    using Replacement = std::pair<std::string_view, std::string_view>;
 
-    std::vector<std::string> result;
-    std::size_t curr = 0;
-    std::size_t token_start = 0;
+    Replacer(const std::initializer_list<Replacement> replacements)
+        : Replacer(std::span<const Replacement>(replacements.begin(), replacements.size())) {}
 
-    while ((curr = str.find(delimiter, curr)) != std::string::npos) {
-        if (behavior == SplitBehavior::KeepEmpty || curr != token_start) {
-            result.emplace_back(str.substr(token_start, curr - token_start));
+    explicit Replacer(const std::span<const Replacement> replacements) {
+        // Bytes that appear in no pattern share class 0, which keeps the transition table small
+        for (const auto& [from, to] : replacements) {
+            for (const char c : from) {
+                const auto byte = static_cast<u8>(c);
+                if (m_class[byte] == 0) m_class[byte] = static_cast<u16>(m_classes++);
+            }
         }
-        curr += delimiter.size();
-        token_start = curr;
-    }
 
-    if (behavior == SplitBehavior::KeepEmpty || token_start != str.size()) {
-        result.emplace_back(str.substr(token_start));
+        add_node(0);
+        for (const auto& [from, to] : replacements) {
+            if (from.empty()) continue;
+            if (!m_starts[static_cast<u8>(from.front())]) {
+                m_starts[static_cast<u8>(from.front())] = true;
+                m_start_bytes += from.front();
+            }
+            u32 node = 0;
+            for (const char c : from) {
+                const std::size_t edge = node * m_classes + m_class[static_cast<u8>(c)];
+                if (m_next[edge] == 0) m_next[edge] = add_node(m_depth[node] + 1); // add_node grows m_next first
+                node = m_next[edge];
+            }
+            if (m_match[node] == 0) {
+                m_patterns.emplace_back(from, to);
+                m_match[node] = static_cast<u32>(m_patterns.size());
+            }
+        }
+
+        // Breadth first, so the failure target of a node is always complete before the node
+        std::vector<u32> fail(m_depth.size(), 0);
+        std::vector<u32> queue;
+        queue.reserve(m_depth.size());
+        for (std::size_t c = 0; c < m_classes; ++c) {
+            if (const u32 child = m_next[c]; child != 0) queue.push_back(child);
+        }
+        for (std::size_t i = 0; i < queue.size(); ++i) {
+            const u32 node = queue[i];
+            // The longest pattern ending here is the node itself or the longest one of its failure target
+            if (m_match[node] == 0) m_match[node] = m_match[fail[node]];
+            for (std::size_t c = 0; c < m_classes; ++c) {
+                u32& next = m_next[node * m_classes + c];
+                const u32 fallback = m_next[fail[node] * m_classes + c];
+                if (next == 0) {
+                    next = fallback;
+                } else {
+                    fail[next] = fallback;
+                    queue.push_back(next);
+                }
+            }
+        }
+    }
+
+    std::string replace(const std::string_view str) const {
+        std::string result;
+        result.reserve(str.size());
+
+        constexpr std::size_t none = std::string_view::npos;
+        std::size_t copied = 0;
+        std::size_t best_start = none;
+        u32 best = 0;
+        u32 state = 0;
+
+        const auto commit = [&] {
+            const auto& [from, to] = m_patterns[best - 1];
+            result.append(str, copied, best_start - copied);
+            result.append(to);
+            copied = best_start + from.size();
+            best_start = none;
+            state = 0;
+        };
+
+        for (std::size_t i = 0; i < str.size(); ++i) {
+            if (state == 0 && best_start == none) {
+                i = next_start(str, i);
+                if (i == str.size()) break;
+            }
+            state = m_next[state * m_classes + m_class[static_cast<u8>(str[i])]];
+            if (const u32 match = m_match[state]; match != 0) {
+                const std::size_t length = m_patterns[match - 1].first.size();
+                const std::size_t start = i + 1 - length;
+                if (best_start == none || start < best_start ||
+                    (start == best_start && length > m_patterns[best - 1].first.size())) {
+                    best_start = start;
+                    best = match;
+                }
+            }
+            // A later match starts at i + 1 - depth at the earliest, once that is past the best match
+            // nothing can beat it anymore and scanning restarts right after it
+            if (best_start != none && i + 1 - m_depth[state] > best_start) {
+                commit();
+                i = copied - 1;
+            }
+        }
+        if (best_start != none) commit();
+
+        result.append(str, copied);
+        return result;
+    }
+
+private:
+    // Position of the next byte a pattern starts with, where the root state is left. A few distinct
+    // start bytes are compared a vector at a time
+    std::size_t next_start(const std::string_view str, std::size_t pos) const noexcept {
+#if UTILS_STRING_SIMD
+        namespace simd = detail::simd;
+        if (!m_start_bytes.empty() && m_start_bytes.size() <= 4) {
+            const auto start_byte = [this](const std::size_t i) {
+                return simd::splat(m_start_bytes[i < m_start_bytes.size() ? i : 0]);
+            };
+            const simd::Vec b0 = start_byte(0);
+            const simd::Vec b1 = start_byte(1);
+            const simd::Vec b2 = start_byte(2);
+            const simd::Vec b3 = start_byte(3);
+            for (; pos + simd::width <= str.size(); pos += simd::width) {
+                const simd::Vec v = simd::load(str.data() + pos);
+                const u64 m = simd::mask(simd::eq(v, b0)) | simd::mask(simd::eq(v, b1)) |
+                              simd::mask(simd::eq(v, b2)) | simd::mask(simd::eq(v, b3));
+                if (m != 0) return pos + simd::first_index(m);
+            }
+        }
+#endif // UTILS_STRING_SIMD
+        while (pos < str.size() && !m_starts[static_cast<u8>(str[pos])]) ++pos;
+        return pos;
     }
 
+    u32 add_node(const u32 depth) {
+        m_next.resize(m_next.size() + m_classes, 0);
+        m_depth.push_back(depth);
+        m_match.push_back(0);
+        return static_cast<u32>(m_depth.size() - 1);
+    }
+
+    std::array<u16, 256> m_class{};
+    std::size_t m_classes = 1;
+    std::vector<u32> m_next;  // m_classes transitions per node, node 0 is the root
+    std::vector<u32> m_depth; // length of the prefix a node stands for
+    std::vector<u32> m_match; // 1 + index of the longest pattern ending at a node, 0 for none
+    std::vector<std::pair<std::string, std::string>> m_patterns;
+    std::array<bool, 256> m_starts{};
+    std::string m_start_bytes;
+};
+
+inline std::string replace_all(const std::string_view str,
+                               const std::initializer_list<Replacer::Replacement> replacements) {
+    return Replacer(replacements).replace(str);
+}
+
+constexpr std::vector<std::string> split(const std::string_view str, const std::string_view delimiter,
+                                         const SplitBehavior behavior = SplitBehavior::Nothing) {
+    std::vector<std::string> result;
+    detail::for_each_token(str, delimiter, behavior, [&result](const std::string_view token) {
+        result.emplace_back(token);
+    });
+    return result;
+}
+
+// Same tokens as split, but as views into str. Writes at most out.size() tokens and returns
+// the total number of tokens, so a result larger than out.size() means out was too small
+constexpr std::size_t split_view(const std::string_view str, const std::string_view delimiter,
+                                 const std::span<std::string_view> out,
+                                 const SplitBehavior behavior = SplitBehavior::Nothing) {
+    std::size_t count = 0;
+    detail::for_each_token(str, delimiter, behavior, [&](const std::string_view token) {
+        if (count < out.size()) out[count] = token;
+        ++count;
+    });
+    return count;
+}
+
+constexpr std::vector<std::string_view> split_view(const std::string_view str, const std::string_view delimiter,
+                                                   const SplitBehavior behavior = SplitBehavior::Nothing) {
+    std::vector<std::string_view> result;
+    detail::for_each_token(str, delimiter, behavior, [&result](const std::string_view token) {
+        result.push_back(token);
+    });
     return result;
 }
 
+// Lazy version of split, tokens are found one at a time while iterating. The views point into
+// the original string, so iterators stay valid after the range itself is gone
+class SplitRange : public std::ranges::view_interface<SplitRange> {
+public:
+    class Iterator {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+
+        constexpr Iterator() = default;
+
+        constexpr std::string_view operator*() const noexcept {
+            return m_str.substr(m_start, m_end - m_start);
+        }
+
+        constexpr Iterator& operator++() noexcept {
+            advance();
+            skip_empty();
+            return *this;
+        }
+
+        constexpr Iterator operator++(int) noexcept {
+            Iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        friend constexpr bool operator==(const Iterator& lhs, const Iterator& rhs) noexcept {
+            return lhs.m_done == rhs.m_done && (lhs.m_done || lhs.m_start == rhs.m_start);
+        }
+
+    private:
+        friend class SplitRange;
+
+        constexpr Iterator(const std::string_view str, const std::string_view delimiter,
+                           const SplitBehavior behavior) noexcept
+            : m_str(str), m_delimiter(delimiter), m_behavior(behavior), m_done(false) {
+            locate(0);
+            skip_empty();
+        }
+
+        // Makes the token starting at start current
+        constexpr void locate(const std::size_t start) noexcept {
+            const std::size_t pos =
+                m_delimiter.empty() ? std::string_view::npos : detail::find(m_str, m_delimiter, start);
+            m_start = start;
+            m_end = pos == std::string_view::npos ? m_str.size() : pos;
+            m_last = pos == std::string_view::npos;
+        }
+
+        constexpr void advance() noexcept {
+            if (m_last) {
+                m_done = true;
+            } else {
+                locate(m_end + m_delimiter.size());
+            }
+        }
+
+        constexpr void skip_empty() noexcept {
+            if (m_behavior == SplitBehavior::KeepEmpty) return;
+            while (!m_done && m_start == m_end && !m_delimiter.empty()) advance();
+        }
+
+        std::string_view m_str;
+        std::string_view m_delimiter;
+        SplitBehavior m_behavior = SplitBehavior::Nothing;
+        std::size_t m_start = 0;
+        std::size_t m_end = 0;
+        bool m_last = true;
+        bool m_done = true;
+    };
+
+    constexpr SplitRange() = default;
+
+    constexpr SplitRange(const std::string_view str, const std::string_view delimiter,
+                         const SplitBehavior behavior = SplitBehavior::Nothing) noexcept
+        : m_str(str), m_delimiter(delimiter), m_behavior(behavior) {}
+
+    constexpr Iterator begin() const noexcept {
+        return { m_str, m_delimiter, m_behavior };
+    }
+
+    constexpr Iterator end() const noexcept {
+        return {};
+    }
+
+private:
+    std::string_view m_str;
+    std::string_view m_delimiter;
+    SplitBehavior m_behavior = SplitBehavior::Nothing;
+};
+
+constexpr SplitRange split_range(const std::string_view str, const std::string_view delimiter,
+                                 const SplitBehavior behavior = SplitBehavior::Nothing) noexcept {
+    return { str, delimiter, behavior };
+}
+
+namespace detail {
+
+// True when all 8 bytes of a little endian word are '0'..'9'. Adding 6 pushes ':'..'?' into the
+// next nibble, a carry out of a byte only happens for bytes that already fail the first test
+constexpr bool is_eight_digits(const u64 word) noexcept {
+    return ((word & 0xF0F0F0F0F0F0F0F0ULL) | (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+           0x3333333333333333ULL;
+}
+
+// Value of 8 decimal digits with the first one in the lowest byte, combining pairs, then quads, then halves
+constexpr u64 parse_eight_digits(u64 word) noexcept {
+    word = ((word & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    word = ((word & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return ((word & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
+}
+
+// str must be all digits
+constexpr std::expected<u64, std::errc> parse_decimal(const std::string_view str) noexcept {
+    if (str.empty()) return std::unexpected(std::errc::invalid_argument);
+
+    u64 value = 0;
+    std::size_t pos = 0;
+    // 8 more digits cannot overflow while value < 10^11
+    for (; pos + 8 <= str.size() && value < 100'000'000'000ULL; pos += 8) {
+        const u64 word = load_word(str.data() + pos);
+        if (!is_eight_digits(word)) break;
+        value = value * 100'000'000 + parse_eight_digits(word);
+    }
+
+    constexpr u64 limit = std::numeric_limits<u64>::max() / 10;
+    constexpr u64 last_digit = std::numeric_limits<u64>::max() % 10;
+    bool overflow = false;
+    for (; pos < str.size(); ++pos) {
+        if (!ascii::is_digit(str[pos])) return std::unexpected(std::errc::invalid_argument);
+        const auto digit = static_cast<u64>(str[pos] - '0');
+        if (value > limit || (value == limit && digit > last_digit)) {
+            overflow = true;
+        } else {
+            value = value * 10 + digit;
+        }
+    }
+    if (overflow) return std::unexpected(std::errc::result_out_of_range);
+    return value;
+}
+
+// str must be all hex digits
+constexpr std::expected<u64, std::errc> parse_hex_digits(const std::string_view str) noexcept {
+    if (str.empty()) return std::unexpected(std::errc::invalid_argument);
+
+    u64 value = 0;
+    bool overflow = false;
+    for (const char c : str) {
+        if (!ascii::is_hex_digit(c)) return std::unexpected(std::errc::invalid_argument);
+        // Digits are their low nibble, letters have 0x40 set and are 9 more than theirs
+        const auto digit = static_cast<u64>((c & 0xF) + ((c >> 6) & 1) * 9);
+        if ((value >> 60) != 0) overflow = true;
+        value = (value << 4) | digit;
+    }
+    if (overflow) return std::unexpected(std::errc::result_out_of_range);
+    return value;
+}
+
+template <typename T, typename F>
+constexpr std::expected<T, std::errc> parse_integer(const std::string_view str, F&& parse_magnitude) noexcept {
+    const bool negative = std::signed_integral<T> && !str.empty() && str.front() == '-';
+    const std::expected<u64, std::errc> magnitude = parse_magnitude(str.substr(negative ? 1 : 0));
+    if (!magnitude) return std::unexpected(magnitude.error());
+
+    if (*magnitude > u64{ std::numeric_limits<T>::max() } + u64{ negative }) {
+        return std::unexpected(std::errc::result_out_of_range);
+    }
+    if constexpr (std::same_as<T, u64>) {
+        return *magnitude;
+    } else {
+        return static_cast<T>(negative ? 0 - *magnitude : *magnitude);
+    }
+}
+
+} // namespace detail
+
+template <typename T>
+concept Number = (std::integral<T> && !std::same_as<T, bool>) || std::floating_point<T>;
+
+// Parses all of str like std::from_chars, so no leading '+' or whitespace. Decimal integers are
+// checked and converted 8 digits at a time
+template <Number T>
+constexpr std::expected<T, std::errc> parse(const std::string_view str) noexcept {
+    if constexpr (std::floating_point<T>) {
+        T value{};
+        const auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+        if (error != std::errc{}) return std::unexpected(error);
+        if (end != str.data() + str.size()) return std::unexpected(std::errc::invalid_argument);
+        return value;
+    } else {
+        return detail::parse_integer<T>(str, detail::parse_decimal);
+    }
+}
+
+// Hex digits of either case without a 0x prefix, with a leading '-' for signed types
+template <Number T>
+    requires std::integral<T>
+constexpr std::expected<T, std::errc> parse_hex(const std::string_view str) noexcept {
+    return detail::parse_integer<T>(str, detail::parse_hex_digits);
+}
+
+// Enough room for format_number with any value of T
+template <Number T>
+inline constexpr std::size_t max_chars =
+    std::floating_point<T> ? std::numeric_limits<T>::max_digits10 + 10 : std::numeric_limits<T>::digits10 + 3;
+
+// Writes value to out and returns the written part, or an empty view when out is too small.
+// max_chars<T> bytes always suffice. Floating point values get the shortest representation
+// that parses back to the same value
+template <Number T>
+std::string_view format_number(const std::span<char> out, const T value) noexcept {
+    const auto [end, error] = std::to_chars(out.data(), out.data() + out.size(), value);
+    if (error != std::errc{}) return {};
+    return { out.data(), end };
+}
+
+struct FieldError {
+    std::size_t index;
+    std::errc error;
+};
+
+struct ParseAllResult {
+    std::size_t count;              // fields written to out
+    std::vector<FieldError> errors; // stays empty, without allocating, when every field parses
+};
+
+// Parses fields into out until either runs out. A field that fails is reported and its slot is
+// set to T{}, so positions in out keep lining up with the fields
+template <Number T, std::ranges::input_range R>
+    requires std::convertible_to<std::ranges::range_reference_t<R>, std::string_view>
+ParseAllResult parse_all(R&& fields, const std::span<T> out) {
+    ParseAllResult result{ 0, {} };
+    for (auto&& field : fields) {
+        if (result.count == out.size()) break;
+        if (const auto parsed = parse<T>(std::string_view(field))) {
+            out[result.count] = *parsed;
+        } else {
+            out[result.count] = T{};
+            result.errors.push_back({ result.count, parsed.error() });
+        }
+        ++result.count;
+    }
+    return result;
+}
+
+// Appends without ever moving what is already written. The first InlineCapacity bytes go to a buffer
+// inside the builder, the rest to chunks from arena that grow with the total size. The result is
+// read back either as one string or piece by piece, e.g. as an iovec list for writev
+template <std::size_t InlineCapacity = 256>
+class Builder {
+public:
+    // Output iterator for std::format_to and the standard algorithms
+    class Appender {
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit Appender(Builder& builder) noexcept : m_builder(&builder) {}
+
+        Appender& operator=(const char c) {
+            m_builder->push_back(c);
+            return *this;
+        }
+
+        Appender& operator*() noexcept {
+            return *this;
+        }
+
+        Appender& operator++() noexcept {
+            return *this;
+        }
+
+        Appender operator++(int) noexcept {
+            return *this;
+        }
+
+    private:
+        Builder* m_builder;
+    };
+
+    explicit Builder(std::pmr::memory_resource* arena = std::pmr::get_default_resource()) noexcept
+        : m_chunks(arena) {}
+
+    Builder(Builder&& other) noexcept : m_chunks(MOVE(other.m_chunks)) {
+        const std::string_view first = other.piece(0);
+        std::ranges::copy(first, m_inline.data());
+        m_current = other.m_current;
+        m_inline_size = first.size();
+        m_before = other.m_before;
+        if (m_current == 0) {
+            m_cursor = m_begin + first.size();
+        } else {
+            m_begin = other.m_begin;
+            m_cursor = other.m_cursor;
+            m_end = other.m_end;
+        }
+        other.m_chunks.clear();
+        other.clear();
+    }
+
+    Builder(const Builder&) = delete;
+    Builder& operator=(const Builder&) = delete;
+    Builder& operator=(Builder&&) = delete;
+
+    ~Builder() {
+        for (const Chunk& chunk : m_chunks) arena()->deallocate(chunk.data, chunk.capacity, 1);
+    }
+
+    void append(const std::string_view str) {
+        if (str.size() <= free_space()) {
+            m_cursor = std::ranges::copy(str, m_cursor).out;
+        } else {
+            append_split(str);
+        }
+    }
+
+    void push_back(const char c) {
+        if (m_cursor == m_end) next_piece(1);
+        *m_cursor++ = c;
+    }
+
+    Builder& operator+=(const std::string_view str) {
+        append(str);
+        return *this;
+    }
+
+    Builder& operator+=(const char c) {
+        push_back(c);
+        return *this;
+    }
+
+    // Formats straight into the free space. If the text does not fit, it is formatted a second time
+    // into a chunk with room for all of it, and the rest of the current piece stays unused.
+    // Formatting only reads the arguments, so forwarding them twice is fine
+    template <typename... Args>
+    void format(const std::format_string<Args...> fmt, Args&&... args) {
+        const auto space = static_cast<std::ptrdiff_t>(free_space());
+        const auto result = std::format_to_n(m_cursor, space, fmt, FORWARD(args)...);
+        if (result.size <= space) {
+            m_cursor = result.out;
+            return;
+        }
+        next_piece(static_cast<std::size_t>(result.size));
+        m_cursor = std::format_to_n(m_cursor, result.size, fmt, FORWARD(args)...).out;
+    }
+
+    [[nodiscard]] Appender appender() noexcept {
+        return Appender(*this);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return m_before + static_cast<std::size_t>(m_cursor - m_begin);
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    // Keeps the chunks, later appends fill them again before asking the arena for more
+    void clear() noexcept {
+        m_current = 0;
+        m_inline_size = 0;
+        m_before = 0;
+        m_begin = m_inline.data();
+        m_cursor = m_begin;
+        m_end = m_begin + InlineCapacity;
+    }
+
+    // The written bytes in order are piece(0) + piece(1) + ... + piece(piece_count() - 1). The views
+    // stay valid until the builder is cleared, moved from or destroyed
+    [[nodiscard]] std::size_t piece_count() const noexcept {
+        return m_current + 1;
+    }
+
+    [[nodiscard]] std::string_view piece(const std::size_t index) const noexcept {
+        ASSERT(index < piece_count(), "Builder piece index out of range");
+        if (index == m_current) return { m_begin, static_cast<std::size_t>(m_cursor - m_begin) };
+        if (index == 0) return { m_inline.data(), m_inline_size };
+        return { m_chunks[index - 1].data, m_chunks[index - 1].size };
+    }
+
+    template <typename F>
+    void for_each_piece(F&& f) const {
+        for (std::size_t i = 0; i < piece_count(); ++i) f(piece(i));
+    }
+
+    // Copies size() bytes to out and returns the end of them
+    char* copy_to(char* out) const noexcept {
+        for_each_piece([&out](const std::string_view str) {
+            out = std::ranges::copy(str, out).out;
+        });
+        return out;
+    }
+
+    [[nodiscard]] std::string str() const {
+        std::string result(size(), '\0');
+        copy_to(result.data());
+        return result;
+    }
+
+#ifndef _WIN32
+    // Fills out with the pieces starting at first and returns how many were written, call again
+    // with first advanced by that to go through more pieces than out holds, e.g. past IOV_MAX
+    std::size_t to_iovec(const std::span<iovec> out, const std::size_t first = 0) const noexcept {
+        std::size_t count = 0;
+        for (std::size_t i = first; i < piece_count() && count < out.size(); ++i, ++count) {
+            const std::string_view str = piece(i);
+            out[count] = { const_cast<char*>(str.data()), str.size() };
+        }
+        return count;
+    }
+#endif // _WIN32
+
+private:
+    struct Chunk {
+        char* data;
+        std::size_t capacity;
+        std::size_t size;
+    };
+
+    [[nodiscard]] std::pmr::memory_resource* arena() const noexcept {
+        return m_chunks.get_allocator().resource();
+    }
+
+    [[nodiscard]] std::size_t free_space() const noexcept {
+        return static_cast<std::size_t>(m_end - m_cursor);
+    }
+
+    void append_split(std::string_view str) {
+        const std::size_t head = free_space();
+        m_cursor = std::ranges::copy(str.substr(0, head), m_cursor).out;
+        str.remove_prefix(head);
+        next_piece(str.size());
+        m_cursor = std::ranges::copy(str, m_cursor).out;
+    }
+
+    // Closes the current piece and moves to a chunk with at least min_capacity bytes, reusing the
+    // next one left by clear when it is large enough
+    void next_piece(const std::size_t min_capacity) {
+        const auto used = static_cast<std::size_t>(m_cursor - m_begin);
+        if (m_current == 0) {
+            m_inline_size = used;
+        } else {
+            m_chunks[m_current - 1].size = used;
+        }
+        m_before += used;
+
+        const std::size_t capacity = std::max({ min_capacity, m_before, 2 * InlineCapacity });
+        if (m_current == m_chunks.size()) {
+            m_chunks.push_back({ static_cast<char*>(arena()->allocate(capacity, 1)), capacity, 0 });
+        } else if (Chunk& chunk = m_chunks[m_current]; chunk.capacity < min_capacity) {
+            arena()->deallocate(chunk.data, chunk.capacity, 1);
+            chunk = { static_cast<char*>(arena()->allocate(capacity, 1)), capacity, 0 };
+        }
+
+        const Chunk& chunk = m_chunks[m_current++];
+        m_begin = chunk.data;
+        m_cursor = m_begin;
+        m_end = m_begin + chunk.capacity;
+    }
+
+    std::array<char, InlineCapacity> m_inline;
+    std::pmr::vector<Chunk> m_chunks;
+    std::size_t m_current = 0; // 0 for the inline buffer, otherwise the chunk index plus one
+    std::size_t m_inline_size = 0; // only kept up to date once the inline buffer is left
+    std::size_t m_before = 0; // bytes in the pieces before the current one
+    char* m_begin = m_inline.data();
+    char* m_cursor = m_begin;
+    char* m_end = m_begin + InlineCapacity;
+};
+
 // Adapted from https://github.com/v8/v8/blob/9e5d8118e2af44b94515db813f5a0aecd8149b7a/src/base/string-format.h
 template <const auto&... strs>
 class StringViewBuilder {
@@ -249,6 +1693,572 @@ private:
     const char* m_c_str;
 };
 
+// Minimal perfect hash over a fixed set of keys, built by hash and displace: keys are grouped into
+// buckets by their hash, then each bucket, largest first, gets the displacement that sends all of
+// its keys to free slots. match hashes the string once and compares it with the one key in its slot
+template <std::size_t N>
+class PerfectHash {
+public:
+    static constexpr std::size_t npos = std::string_view::npos;
+
+    // The keys must be unique and outlive the PerfectHash, e.g. string literals
+    constexpr explicit PerfectHash(const std::array<std::string_view, N>& keys) {
+        if constexpr (N > 0) build(keys);
+    }
+
+    // Index of str in the keys given to the constructor, or npos
+    [[nodiscard]] constexpr std::size_t match(const std::string_view str) const noexcept {
+        if constexpr (N == 0) {
+            UNUSED(str);
+            return npos;
+        } else {
+            const u64 hash = detail::hash_bytes<false>(str);
+            const Slot& slot = m_slots[slot_of(hash, m_displacements[hash % N])];
+            return slot.key == str ? slot.index : npos;
+        }
+    }
+
+    [[nodiscard]] constexpr bool contains(const std::string_view str) const noexcept {
+        return match(str) != npos;
+    }
+
+    [[nodiscard]] constexpr std::string_view key(const std::size_t index) const noexcept {
+        ASSERT(index < N, "PerfectHash key index out of range");
+        return m_keys[index];
+    }
+
+    [[nodiscard]] static constexpr std::size_t size() noexcept {
+        return N;
+    }
+
+private:
+    struct Slot {
+        std::string_view key;
+        std::size_t index = npos;
+    };
+
+    // A negative displacement marks a bucket with a single key, which is stored in slot
+    // -1 - displacement. Other buckets hash their keys again with the displacement added
+    static constexpr std::size_t slot_of(const u64 hash, const i32 displacement) noexcept {
+        if (displacement < 0) return static_cast<std::size_t>(-1 - displacement);
+        return detail::mix(hash + static_cast<u64>(displacement)) % N;
+    }
+
+    constexpr void build(const std::array<std::string_view, N>& keys) {
+        std::array<u64, N> hashes{};
+        std::array<std::size_t, N> bucket_sizes{};
+        std::array<std::size_t, N> order{};
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t j = 0; j < i; ++j) ASSERT(keys[i] != keys[j], "PerfectHash keys must be unique");
+            m_keys[i] = keys[i];
+            hashes[i] = detail::hash_bytes<false>(keys[i]);
+            ++bucket_sizes[hashes[i] % N];
+            order[i] = i;
+        }
+
+        // Keys of the same bucket next to each other, the largest buckets first
+        std::ranges::sort(order, [&](const std::size_t a, const std::size_t b) {
+            const std::size_t bucket_a = hashes[a] % N;
+            const std::size_t bucket_b = hashes[b] % N;
+            if (bucket_sizes[bucket_a] != bucket_sizes[bucket_b]) return bucket_sizes[bucket_a] > bucket_sizes[bucket_b];
+            return bucket_a < bucket_b;
+        });
+
+        std::size_t next_free = 0; // singles fill the slots left over, in order
+        for (std::size_t begin = 0; begin < N;) {
+            const std::size_t bucket = hashes[order[begin]] % N;
+            const std::size_t end = begin + bucket_sizes[bucket];
+
+            if (end - begin == 1) {
+                while (m_slots[next_free].index != npos) ++next_free;
+                m_displacements[bucket] = -1 - static_cast<i32>(next_free);
+                m_slots[next_free] = { keys[order[begin]], order[begin] };
+            } else {
+                for (i32 displacement = 0;; ++displacement) {
+                    ASSERT(displacement < std::numeric_limits<i32>::max(), "PerfectHash found no displacement");
+                    if (try_place(keys, hashes, std::span(order).subspan(begin, end - begin), displacement)) {
+                        m_displacements[bucket] = displacement;
+                        break;
+                    }
+                }
+            }
+            begin = end;
+        }
+    }
+
+    // Places all keys of a bucket or none of them
+    constexpr bool try_place(const std::array<std::string_view, N>& keys, const std::array<u64, N>& hashes,
+                             const std::span<const std::size_t> bucket, const i32 displacement) {
+        for (std::size_t i = 0; i < bucket.size(); ++i) {
+            Slot& slot = m_slots[slot_of(hashes[bucket[i]], displacement)];
+            if (slot.index != npos) {
+                for (std::size_t j = 0; j < i; ++j) m_slots[slot_of(hashes[bucket[j]], displacement)] = {};
+                return false;
+            }
+            slot = { keys[bucket[i]], bucket[i] };
+        }
+        return true;
+    }
+
+    std::array<std::string_view, N> m_keys{};
+    std::array<i32, N> m_displacements{};
+    std::array<Slot, N> m_slots{};
+};
+
+template <typename... Keys>
+    requires(std::convertible_to<const Keys&, std::string_view> && ...)
+constexpr PerfectHash<sizeof...(Keys)> make_perfect_hash(const Keys&... keys) {
+    return PerfectHash<sizeof...(Keys)>({ std::string_view(keys)... });
+}
+
+// The same for strings with static storage duration, like the StringViewBuilder parameters
+template <const auto&... strs>
+inline constexpr PerfectHash<sizeof...(strs)> perfect_hash =
+    PerfectHash<sizeof...(strs)>({ detail::to_view(strs)... });
+
+// Maps strings to stable 32 bit ids and keeps one copy of each in an arena. The strings are spread
+// over shards by hash, each with its own lock, arena and open addressing table. Lookups never lock:
+// a table is only replaced by a larger copy, the old ones stay in the arena until destruction, and
+// entries are written before the table slot that points to them
+class Interner {
+public:
+    using Id = u32;
+    static constexpr Id npos = std::numeric_limits<Id>::max();
+    static constexpr std::size_t shard_count = 16;
+
+    // upstream does not need to be thread safe, the shards only reach it through a lock
+    explicit Interner(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream(upstream), m_shards(make_shards(&m_upstream, std::make_index_sequence<shard_count>())) {}
+
+    Interner(const Interner&) = delete;
+    Interner(Interner&&) = delete;
+    Interner& operator=(const Interner&) = delete;
+    Interner& operator=(Interner&&) = delete;
+    ~Interner() = default;
+
+    // The id of str, copying it into the arena the first time it is seen
+    Id intern(const std::string_view str) {
+        const u64 hash = detail::hash_bytes<false>(str);
+        Shard& shard = m_shards[hash % shard_count];
+        if (const Id id = find_in(shard, hash, str); id != npos) return id;
+
+        const std::scoped_lock lock(shard.mutex);
+        if (const Id id = find_in(shard, hash, str); id != npos) return id;
+        return insert(shard, hash, str);
+    }
+
+    // The id of str, or npos when it was never interned
+    [[nodiscard]] Id find(const std::string_view str) const noexcept {
+        const u64 hash = detail::hash_bytes<false>(str);
+        return find_in(m_shards[hash % shard_count], hash, str);
+    }
+
+    [[nodiscard]] bool contains(const std::string_view str) const noexcept {
+        return find(str) != npos;
+    }
+
+    // The interned copy, valid until the interner is destroyed
+    [[nodiscard]] std::string_view view(const Id id) const noexcept {
+        const Shard& shard = m_shards[id % shard_count];
+        ASSERT(id / shard_count < shard.size.load(std::memory_order_acquire), "Interner id out of range");
+        return entry(shard, id / shard_count);
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        std::size_t total = 0;
+        for (const Shard& shard : m_shards) total += shard.size.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return size() == 0;
+    }
+
+private:
+    // Slots hold the high half of the hash and the index in the shard plus one, 0 marks a free slot
+    struct Table {
+        std::size_t mask;
+        std::atomic<u64>* slots;
+    };
+
+    static constexpr std::size_t first_table = 128;
+
+    // Entries live in segments of 64, 128, 256, ... so they never move when more are added
+    static constexpr std::size_t first_segment = 64;
+    static constexpr std::size_t segment_count = 32;
+    static constexpr std::size_t max_shard_size = (npos / shard_count) - 1;
+
+    // Serializes the arenas' requests for new blocks, which are rare enough that one lock is fine
+    class LockedResource final : public std::pmr::memory_resource {
+    public:
+        explicit LockedResource(std::pmr::memory_resource* upstream) : m_upstream(upstream) {}
+
+    private:
+        void* do_allocate(const std::size_t bytes, const std::size_t alignment) override {
+            const std::scoped_lock lock(m_mutex);
+            return m_upstream->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* ptr, const std::size_t bytes, const std::size_t alignment) override {
+            const std::scoped_lock lock(m_mutex);
+            m_upstream->deallocate(ptr, bytes, alignment);
+        }
+
+        [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+
+        std::mutex m_mutex;
+        std::pmr::memory_resource* m_upstream;
+    };
+
+    struct alignas(64) Shard {
+        explicit Shard(std::pmr::memory_resource* upstream) : arena(upstream) {}
+
+        std::mutex mutex;
+        std::pmr::monotonic_buffer_resource arena; // strings, segments and tables, only used under mutex
+        std::atomic<Table*> table{nullptr};
+        std::array<std::atomic<std::string_view*>, segment_count> segments{};
+        std::atomic<u32> size{0};
+    };
+
+    template <std::size_t... I>
+    static std::array<Shard, shard_count> make_shards(std::pmr::memory_resource* upstream,
+                                                      std::index_sequence<I...>) {
+        return { (UNUSED(I), Shard(upstream))... };
+    }
+
+    static constexpr std::pair<std::size_t, std::size_t> segment_of(const std::size_t index) noexcept {
+        const std::size_t biased = index + first_segment;
+        const std::size_t segment = static_cast<std::size_t>(std::bit_width(biased) - std::bit_width(first_segment));
+        return { segment, biased - (first_segment << segment) };
+    }
+
+    static std::string_view entry(const Shard& shard, const std::size_t index) noexcept {
+        const auto [segment, offset] = segment_of(index);
+        return shard.segments[segment].load(std::memory_order_acquire)[offset];
+    }
+
+    static Id find_in(const Shard& shard, const u64 hash, const std::string_view str) noexcept {
+        const Table* table = shard.table.load(std::memory_order_acquire);
+        if (table == nullptr) return npos;
+
+        for (std::size_t pos = (hash / shard_count) & table->mask;; pos = (pos + 1) & table->mask) {
+            const u64 slot = table->slots[pos].load(std::memory_order_acquire);
+            if (slot == 0) return npos;
+            if ((slot >> 32) != (hash >> 32)) continue;
+
+            const std::size_t index = (slot & 0xFFFFFFFFULL) - 1;
+            if (entry(shard, index) == str) return static_cast<Id>(index * shard_count + (hash % shard_count));
+        }
+    }
+
+    static constexpr u64 make_slot(const u64 hash, const u32 index) noexcept {
+        return (hash & 0xFFFFFFFF00000000ULL) | (u64{ index } + 1);
+    }
+
+    static void place(const Table& table, const u64 slot, const u64 hash) noexcept {
+        std::size_t pos = (hash / shard_count) & table.mask;
+        while (table.slots[pos].load(std::memory_order_relaxed) != 0) pos = (pos + 1) & table.mask;
+        table.slots[pos].store(slot, std::memory_order_release);
+    }
+
+    // Copies every entry into a table twice as large and publishes it. Readers still probing the
+    // old one may miss strings inserted after this, which they could not have known the id of anyway
+    static Table* grow(Shard& shard, const Table* old) {
+        const std::size_t capacity = old == nullptr ? first_table : 2 * (old->mask + 1);
+        auto* slots = static_cast<std::atomic<u64>*>(
+            shard.arena.allocate(capacity * sizeof(std::atomic<u64>), alignof(std::atomic<u64>)));
+        for (std::size_t i = 0; i < capacity; ++i) std::construct_at(slots + i, 0);
+        auto* table = std::construct_at(static_cast<Table*>(shard.arena.allocate(sizeof(Table), alignof(Table))),
+                                        capacity - 1, slots);
+
+        const u32 size = shard.size.load(std::memory_order_relaxed);
+        for (u32 index = 0; index < size; ++index) {
+            const u64 hash = detail::hash_bytes<false>(entry(shard, index));
+            place(*table, make_slot(hash, index), hash);
+        }
+        shard.table.store(table, std::memory_order_release);
+        return table;
+    }
+
+    static Id insert(Shard& shard, const u64 hash, const std::string_view str) {
+        const u32 index = shard.size.load(std::memory_order_relaxed);
+        ASSERT(index < max_shard_size, "Interner is full");
+
+        const Table* table = shard.table.load(std::memory_order_relaxed);
+        if (table == nullptr || 2 * (std::size_t{ index } + 1) > table->mask + 1) table = grow(shard, table);
+
+        const auto [segment, offset] = segment_of(index);
+        std::string_view* entries = shard.segments[segment].load(std::memory_order_relaxed);
+        if (entries == nullptr) {
+            const std::size_t count = first_segment << segment;
+            entries = static_cast<std::string_view*>(
+                shard.arena.allocate(count * sizeof(std::string_view), alignof(std::string_view)));
+            std::uninitialized_default_construct_n(entries, count);
+            shard.segments[segment].store(entries, std::memory_order_release);
+        }
+
+        char* data = nullptr;
+        if (!str.empty()) {
+            data = static_cast<char*>(shard.arena.allocate(str.size(), 1));
+            std::ranges::copy(str, data);
+        }
+        entries[offset] = { data, str.size() };
+
+        place(*table, make_slot(hash, index), hash);
+        shard.size.store(index + 1, std::memory_order_release);
+        return static_cast<Id>(std::size_t{ index } * shard_count + (hash % shard_count));
+    }
+
+    LockedResource m_upstream;
+    std::array<Shard, shard_count> m_shards;
+};
+
+#ifndef _WIN32
+// Splits a file or a stream into records, e.g. lines, without holding more than a chunk of it.
+// Files opened by path are memory mapped and pages behind the current record are dropped again,
+// other descriptors such as pipes are read into a page aligned buffer. Only a record that crosses
+// the end of the buffer is moved, to the front of it, and the buffer only grows for records longer
+// than a chunk. Records are found with the vectorized find_byte
+class LineReader {
+public:
+    static constexpr std::size_t default_chunk_size = std::size_t{1} << 20;
+
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() noexcept = default;
+        explicit Iterator(LineReader& reader) : m_reader(&reader) {
+            ++*this;
+        }
+
+        const std::string_view& operator*() const noexcept {
+            return m_record;
+        }
+
+        const std::string_view* operator->() const noexcept {
+            return &m_record;
+        }
+
+        Iterator& operator++() {
+            if (!m_reader->next(m_record)) m_reader = nullptr;
+            return *this;
+        }
+        void operator++(int) {
+            ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const noexcept {
+            return m_reader == nullptr;
+        }
+
+    private:
+        LineReader* m_reader = nullptr;
+        std::string_view m_record;
+    };
+
+    // Reads from fd, which the caller keeps owning, chunk_size bytes at a time
+    explicit LineReader(const int fd, const char delimiter = '\n',
+                        const std::size_t chunk_size = default_chunk_size) noexcept
+        : m_fd(fd), m_delimiter(delimiter), m_chunk_size(std::bit_ceil(std::max(chunk_size, page_size()))) {}
+
+    // Maps the file, or reads it like any other descriptor when it cannot be mapped, e.g. a FIFO
+    static std::expected<LineReader, std::string> open(const std::string& path, const char delimiter = '\n',
+                                                       const std::size_t chunk_size = default_chunk_size) {
+        LineReader reader(::open(path.c_str(), O_RDONLY | O_CLOEXEC), delimiter, chunk_size);
+        if (reader.m_fd < 0) {
+            return std::unexpected("Could not open file '" + path + "' for reading: " + std::strerror(errno));
+        }
+        reader.m_owned = true;
+
+        struct stat info{};
+        if (::fstat(reader.m_fd, &info) != 0 || !S_ISREG(info.st_mode)) return reader;
+        if (info.st_size == 0) {
+            reader.m_eof = true;
+            return reader;
+        }
+
+        const auto size = static_cast<std::size_t>(info.st_size);
+        void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, reader.m_fd, 0);
+        if (data == MAP_FAILED) return reader;
+        ::madvise(data, size, MADV_SEQUENTIAL);
+
+        reader.m_data = static_cast<char*>(data);
+        reader.m_capacity = size;
+        reader.m_end = size;
+        reader.m_mapped = true;
+        reader.m_eof = true;
+        return reader;
+    }
+
+    LineReader(const LineReader&) = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    LineReader(LineReader&& other) noexcept
+        : m_fd(std::exchange(other.m_fd, -1)), m_owned(std::exchange(other.m_owned, false)),
+          m_mapped(std::exchange(other.m_mapped, false)), m_eof(other.m_eof), m_delimiter(other.m_delimiter),
+          m_error(other.m_error), m_chunk_size(other.m_chunk_size), m_data(std::exchange(other.m_data, nullptr)),
+          m_capacity(std::exchange(other.m_capacity, 0)), m_begin(std::exchange(other.m_begin, 0)),
+          m_scanned(std::exchange(other.m_scanned, 0)), m_end(std::exchange(other.m_end, 0)),
+          m_released(std::exchange(other.m_released, 0)) {}
+
+    LineReader& operator=(LineReader&& other) noexcept {
+        if (this != &other) {
+            close();
+            m_fd = std::exchange(other.m_fd, -1);
+            m_owned = std::exchange(other.m_owned, false);
+            m_mapped = std::exchange(other.m_mapped, false);
+            m_eof = other.m_eof;
+            m_delimiter = other.m_delimiter;
+            m_error = other.m_error;
+            m_chunk_size = other.m_chunk_size;
+            m_data = std::exchange(other.m_data, nullptr);
+            m_capacity = std::exchange(other.m_capacity, 0);
+            m_begin = std::exchange(other.m_begin, 0);
+            m_scanned = std::exchange(other.m_scanned, 0);
+            m_end = std::exchange(other.m_end, 0);
+            m_released = std::exchange(other.m_released, 0);
+        }
+        return *this;
+    }
+
+    ~LineReader() {
+        close();
+    }
+
+    // Sets record to the next record without its delimiter and returns true. The last record does
+    // not need a delimiter. Returns false at the end of the input or when reading failed, see error.
+    // The record stays valid until the next call
+    bool next(std::string_view& record) {
+        for (;;) {
+            const std::size_t pos = detail::find_byte({ m_data, m_end }, m_delimiter, m_scanned);
+            if (pos != std::string_view::npos) {
+                record = { m_data + m_begin, pos - m_begin };
+                if (m_mapped) release_before(m_begin);
+                m_begin = pos + 1;
+                m_scanned = m_begin;
+                return true;
+            }
+            m_scanned = m_end;
+
+            if (m_eof) {
+                if (m_begin == m_end) return false;
+                record = { m_data + m_begin, m_end - m_begin };
+                m_begin = m_end;
+                return true;
+            }
+            refill();
+        }
+    }
+
+    [[nodiscard]] Iterator begin() {
+        return Iterator(*this);
+    }
+
+    [[nodiscard]] std::default_sentinel_t end() const noexcept {
+        return {};
+    }
+
+    // The errno of the read that failed, 0 when the input was read to the end
+    [[nodiscard]] int error() const noexcept {
+        return m_error;
+    }
+
+    [[nodiscard]] bool mapped() const noexcept {
+        return m_mapped;
+    }
+
+private:
+    // Queried once, the read buffer is aligned to it and handed back a page at a time
+    static std::size_t page_size() noexcept {
+        static const std::size_t size = [] {
+            const long value = ::sysconf(_SC_PAGESIZE);
+            return value > 0 ? static_cast<std::size_t>(value) : std::size_t{4096};
+        }();
+        return size;
+    }
+
+    // Moves the unfinished record to the front, or into a buffer twice as large when it fills the
+    // whole buffer, and reads as much as fits after it
+    void refill() {
+        const std::size_t pending = m_end - m_begin;
+        if (m_data == nullptr || pending == m_capacity) {
+            const std::size_t capacity = m_data == nullptr ? m_chunk_size : 2 * m_capacity;
+            auto* data = static_cast<char*>(::operator new(capacity, std::align_val_t{ page_size() }));
+            if (m_data != nullptr) std::memcpy(data, m_data + m_begin, pending);
+            free_buffer();
+            m_data = data;
+            m_capacity = capacity;
+        } else if (pending != 0 && m_begin != 0) {
+            std::memmove(m_data, m_data + m_begin, pending);
+        }
+        m_begin = 0;
+        m_scanned = pending;
+        m_end = pending;
+
+        for (;;) {
+            const ::ssize_t count = ::read(m_fd, m_data + m_end, m_capacity - m_end);
+            if (count > 0) {
+                m_end += static_cast<std::size_t>(count);
+                return;
+            }
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) m_error = errno;
+            m_eof = true;
+            return;
+        }
+    }
+
+    // Hands the pages before offset back once a chunk of them has been consumed. Called with the
+    // start of the record being returned, so the page holding it stays mapped for the caller
+    void release_before(const std::size_t offset) noexcept {
+        const std::size_t consumed = offset & ~(page_size() - 1);
+        if (consumed - m_released < m_chunk_size) return;
+        ::madvise(m_data + m_released, consumed - m_released, MADV_DONTNEED);
+        m_released = consumed;
+    }
+
+    void free_buffer() noexcept {
+        if (m_data == nullptr) return;
+        if (m_mapped) {
+            ::munmap(m_data, m_capacity);
+        } else {
+            ::operator delete(m_data, std::align_val_t{ page_size() });
+        }
+        m_data = nullptr;
+    }
+
+    void close() noexcept {
+        free_buffer();
+        if (m_owned && m_fd >= 0) ::close(m_fd);
+        m_fd = -1;
+        m_owned = false;
+        m_mapped = false;
+    }
+
+    int m_fd;
+    bool m_owned = false;
+    bool m_mapped = false;
+    bool m_eof = false;
+    char m_delimiter;
+    int m_error = 0;
+    std::size_t m_chunk_size;
+    char* m_data = nullptr;
+    std::size_t m_capacity = 0;
+    std::size_t m_begin = 0; // start of the next record
+    std::size_t m_scanned = 0; // bytes of it already searched for the delimiter
+    std::size_t m_end = 0;
+    std::size_t m_released = 0; // mapped pages before this were dropped
+};
+#endif // _WIN32
+
 } // namespace utils::string
 
+template <>
+inline constexpr bool std::ranges::enable_borrowed_range<utils::string::SplitRange> = true;
+
 #endif // UTILS_STRING_HPP
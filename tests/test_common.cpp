@@ -60,3 +60,17 @@ TEST_CASE("ASSERT behavior in release mode") {
     CHECK_NOTHROW(ASSERT(false, "Should not do anything"));
 }
 #endif
+
+namespace {
+int abort_handler_calls = 0;
+}
+
+TEST_CASE("abort handler") {
+    const utils::AbortHandler previous = utils::set_abort_handler([] { ++abort_handler_calls; });
+    utils::run_abort_handler();
+    CHECK(abort_handler_calls == 1);
+
+    CHECK(utils::set_abort_handler(previous) != nullptr);
+    utils::run_abort_handler();
+    CHECK(abort_handler_calls == 1);
+}
@@ -5,10 +5,28 @@
 #undef ERROR
 
 #include "ext/doctest_extensions.hpp"
+
+#define UTILS_LOG_PROCESS_COMPRESSOR
+#define UTILS_PROCESS_IMPLEMENTATION
 #include "log.hpp"
 
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <span>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif // _WIN32
 
 using namespace utils::log;
 
@@ -73,3 +91,964 @@ TEST_CASE("print example log messages") {
     WARNING("This is a warning message");
     ERROR("This is an error message");
 }
+
+namespace {
+
+std::size_t count_occurrences(const std::string& haystack, const std::string_view needle) {
+    std::size_t count = 0;
+    for (std::size_t pos = haystack.find(needle); pos != std::string::npos; pos = haystack.find(needle, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+std::string read_file(const std::string& filename) {
+    const std::ifstream file(filename, std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+} // namespace
+
+TEST_CASE("SPSC queue wraps variable sized records") {
+    detail::SpscQueue queue(64);
+    CHECK(queue.capacity() == 64);
+    CHECK(queue.front() == nullptr);
+
+    for (int i = 0; i < 100; ++i) {
+        const std::size_t size = static_cast<std::size_t>(i % 3) * 8 + 4;
+        std::byte* ptr = queue.prepare_write(size);
+        REQUIRE(ptr != nullptr);
+        std::memset(ptr, i, size);
+        queue.commit_write();
+
+        const std::byte* record = queue.front();
+        REQUIRE(record != nullptr);
+        CHECK(std::to_integer<int>(record[size - 1]) == i);
+        queue.pop();
+        CHECK(queue.front() == nullptr);
+    }
+
+    // Full queue rejects writes until the consumer catches up
+    while (queue.prepare_write(8) != nullptr) queue.commit_write();
+    CHECK(queue.front() != nullptr);
+    queue.pop();
+    CHECK(queue.prepare_write(8) != nullptr);
+}
+
+TEST_CASE("SPSC queue wraps records larger than the remaining tail") {
+    detail::SpscQueue queue(64);
+
+    // Move the write position to offset 32, leaving 32 bytes before the end
+    REQUIRE(queue.prepare_write(24) != nullptr);
+    queue.commit_write();
+    REQUIRE(queue.front() != nullptr);
+    queue.pop();
+
+    // Padding plus the record exceed the capacity, so the record waits until the padding is read
+    CHECK(queue.prepare_write(40) == nullptr);
+    CHECK(queue.front() == nullptr);
+
+    std::byte* ptr = queue.prepare_write(40);
+    REQUIRE(ptr != nullptr);
+    std::memset(ptr, 7, 40);
+    queue.commit_write();
+
+    const std::byte* record = queue.front();
+    REQUIRE(record != nullptr);
+    CHECK(std::to_integer<int>(record[39]) == 7);
+    queue.pop();
+    CHECK(queue.front() == nullptr);
+    CHECK(queue.empty());
+}
+
+TEST_CASE("async logging from multiple threads") {
+    detail::logger::instance().set_log_level(LogLevel::DEBUG);
+    testing::CaptureStderr();
+    start_async();
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([t] {
+                for (int i = 0; i < 100; ++i) INFO("async thread {} message {}", t, i);
+            });
+        }
+    }
+    DEBUG("async debug {}", 1);
+    stop_async();
+    const std::string output = testing::GetCapturedStderr();
+
+    CHECK(count_occurrences(output, "[INFO] async thread") == 400);
+    CHECK(output.find("[INFO] async thread 3 message 99\n") != std::string::npos);
+    CHECK(output.find("] async debug 1") != std::string::npos);
+    CHECK(output.find("test_log.cpp") != std::string::npos);
+}
+
+TEST_CASE("async overflow policies") {
+    detail::logger::instance().set_log_level(LogLevel::INFO);
+    constexpr int count = 5000;
+
+    SUBCASE("drop counts every discarded record") {
+        const u64 dropped_before = dropped_count();
+        testing::CaptureStderr();
+        start_async({.queue_capacity = 256, .overflow = OverflowPolicy::Drop, .idle_sleep = std::chrono::milliseconds(5)});
+        for (int i = 0; i < count; ++i) INFO("drop {}", i);
+        stop_async();
+        const std::string output = testing::GetCapturedStderr();
+
+        const u64 dropped = dropped_count() - dropped_before;
+        CHECK(dropped > 0);
+        CHECK(count_occurrences(output, "[INFO] drop") + dropped == count);
+        CHECK(output.find("Dropped") != std::string::npos);
+    }
+
+    SUBCASE("grow keeps every record in order") {
+        testing::CaptureStderr();
+        start_async({.queue_capacity = 256, .overflow = OverflowPolicy::Grow, .idle_sleep = std::chrono::milliseconds(5)});
+        for (int i = 0; i < count; ++i) INFO("grow {}", i);
+        stop_async();
+        const std::string output = testing::GetCapturedStderr();
+
+        CHECK(count_occurrences(output, "[INFO] grow") == count);
+        CHECK(output.find("grow 4998\n[INFO] grow 4999\n") != std::string::npos);
+    }
+
+    SUBCASE("block never loses records") {
+        testing::CaptureStderr();
+        start_async({.queue_capacity = 256, .overflow = OverflowPolicy::Block});
+        for (int i = 0; i < count; ++i) INFO("block {}", i);
+        stop_async();
+        const std::string output = testing::GetCapturedStderr();
+
+        CHECK(count_occurrences(output, "[INFO] block") == count);
+    }
+
+    SUBCASE("block writes records larger than half the queue") {
+        const std::string payload(120, 'x');
+        testing::CaptureStderr();
+        start_async({.queue_capacity = 256, .overflow = OverflowPolicy::Block});
+        // The small record leaves less than a large one before the end of the buffer
+        for (int i = 0; i < 100; ++i) {
+            INFO("small");
+            INFO("large {} {}", i, payload);
+        }
+        stop_async();
+        const std::string output = testing::GetCapturedStderr();
+
+        CHECK(count_occurrences(output, "[INFO] small") == 100);
+        CHECK(count_occurrences(output, "[INFO] large") == 100);
+    }
+}
+
+TEST_CASE("deferred formatting copies arguments into the record") {
+    static_assert(detail::deferrable<int>());
+    static_assert(detail::deferrable<const double&>());
+    static_assert(detail::deferrable<std::string>());
+    static_assert(detail::deferrable<const char (&)[4]>());
+    static_assert(detail::deferrable<std::string_view>());
+    static_assert(!detail::deferrable<std::vector<int>>());
+
+    detail::logger::instance().set_log_level(LogLevel::DEBUG);
+    testing::CaptureStderr();
+    start_async();
+    {
+        std::string temporary = "short lived";
+        const char* c_str = "c string";
+        INFO("deferred {} {:>5} {:.2f} {} {} {}", 42, true, 3.14159, temporary, c_str, 'x');
+        temporary.assign("overwritten after the call");
+        INFO("deferred {1} before {0}", std::string("moved from"), std::string_view("view"));
+        DEBUG("deferred debug {:#x}", 255u);
+        WARNING("deferred without arguments");
+    }
+    stop_async();
+    const std::string output = testing::GetCapturedStderr();
+
+    CHECK(output.find("[INFO] deferred 42  true 3.14 short lived c string x\n") != std::string::npos);
+    CHECK(output.find("[INFO] deferred view before moved from\n") != std::string::npos);
+    CHECK(output.find("] deferred debug 0xff\n") != std::string::npos);
+    CHECK(output.find("[WARNING] deferred without arguments\n") != std::string::npos);
+}
+
+TEST_CASE("eager formatting in async mode") {
+    detail::logger::instance().set_log_level(LogLevel::INFO);
+    testing::CaptureStderr();
+    start_async({.deferred_format = false});
+    INFO("eager {} {}", 1, std::string("two"));
+    stop_async();
+    const std::string output = testing::GetCapturedStderr();
+
+    CHECK(output.find("[INFO] eager 1 two\n") != std::string::npos);
+}
+
+namespace {
+
+// Converts to a string_view but formats differently, so it must not be copied as plain text
+struct Labelled {
+    std::string_view name;
+
+    operator std::string_view() const noexcept {
+        return name;
+    }
+};
+
+} // namespace
+
+template <>
+struct std::formatter<Labelled> : std::formatter<std::string_view> {
+    auto format(const Labelled& value, std::format_context& ctx) const {
+        return std::format_to(ctx.out(), "<{}>", value.name);
+    }
+};
+
+TEST_CASE("types converting to string_view keep their formatter when deferred") {
+    static_assert(!detail::string_like<Labelled>);
+
+    detail::logger::instance().set_log_level(LogLevel::INFO);
+    testing::CaptureStderr();
+    INFO("labelled {}", Labelled{"name"});
+    const std::string sync_output = testing::GetCapturedStderr();
+
+    testing::CaptureStderr();
+    start_async();
+    INFO("labelled {}", Labelled{"name"});
+    stop_async();
+    const std::string deferred_output = testing::GetCapturedStderr();
+
+    CHECK(sync_output.find("[INFO] labelled <name>\n") != std::string::npos);
+    CHECK(deferred_output == sync_output);
+}
+
+TEST_CASE("ring sink keeps the latest lines") {
+    const RingSink ring(32);
+    ring.write("first line\n");
+    CHECK(ring.contents() == "first line\n");
+
+    ring.write("second line\nthird line\n");
+    CHECK(ring.contents() == "second line\nthird line\n");
+
+    // Only the end of the line fits, and it is not a complete line
+    ring.write("a line that is longer than the whole ring\n");
+    CHECK(ring.contents().empty());
+    ring.write("short\n");
+    CHECK(ring.contents() == "short\n");
+
+    // The oldest byte kept starts a line, so nothing is trimmed
+    const RingSink aligned(16);
+    aligned.write("0123\nabcdefghij\n");
+    aligned.write("wxyz\n");
+    CHECK(aligned.contents() == "abcdefghij\nwxyz\n");
+    aligned.write("01234");
+    CHECK(aligned.contents() == "wxyz\n01234");
+    aligned.write("56789\n");
+    CHECK(aligned.contents() == "wxyz\n0123456789\n");
+
+    const RingSink skipped(8);
+    skipped.write("abc\ndefghij\n");
+    CHECK(skipped.contents() == "defghij\n");
+
+    const RingSink small(4);
+    small.write("abcdefg");
+    CHECK(small.contents() == "defg");
+    small.write("xy");
+    CHECK(small.contents() == "fgxy");
+    small.write("0123456789");
+    CHECK(small.contents() == "6789");
+
+    ring.clear();
+    CHECK(ring.contents().empty());
+}
+
+TEST_CASE("custom sinks") {
+    detail::logger::instance().set_log_level(LogLevel::INFO);
+
+    SUBCASE("sink list fans out to every sink") {
+        const RingSink first(1024);
+        const RingSink second(1024);
+        set_sink(SinkList(first, second));
+        INFO("to both sinks {}", 1);
+        set_sink(StderrSink{});
+
+        CHECK(first.contents() == "[INFO] to both sinks 1\n");
+        CHECK(second.contents() == "[INFO] to both sinks 1\n");
+    }
+
+    SUBCASE("async backend writes batches to the sink") {
+        const RingSink ring(1 << 16);
+        set_sink(ring);
+        start_async();
+        for (int i = 0; i < 100; ++i) INFO("ring {}", i);
+        stop_async();
+        set_sink(StderrSink{});
+
+        const std::string contents = ring.contents();
+        CHECK(count_occurrences(contents, "[INFO] ring") == 100);
+        CHECK(contents.ends_with("[INFO] ring 99\n"));
+    }
+
+    SUBCASE("sinks report their descriptor for signal handlers") {
+        CHECK(detail::AnySink(StderrSink{}).fd() == 2);
+        CHECK(detail::AnySink(FdSink(7)).fd() == 7);
+        CHECK(detail::AnySink(RingSink(16)).fd() == -1);
+    }
+
+    SUBCASE("fd sink appends to a file") {
+        const std::string filename = "test_log_fd_sink.txt";
+        std::remove(filename.c_str());
+
+        auto sink = FdSink::open(filename);
+        REQUIRE(sink.has_value());
+        set_sink(MOVE(*sink));
+        INFO("to a file {}", 2);
+        set_sink(StderrSink{});
+
+        CHECK(read_file(filename) == "[INFO] to a file 2\n");
+        std::remove(filename.c_str());
+    }
+
+    SUBCASE("fd sink reports open errors") {
+        const auto sink = FdSink::open("non_existent_directory/log.txt");
+        REQUIRE(!sink.has_value());
+        CHECK(sink.error().find("non_existent_directory/log.txt") != std::string::npos);
+    }
+}
+
+TEST_CASE("rotating file sink") {
+    const std::string filename = "test_log_rotating.txt";
+    const auto cleanup = [&] {
+        std::remove(filename.c_str());
+        for (int i = 1; i <= 3; ++i) std::remove(std::format("{}.{}", filename, i).c_str());
+    };
+    cleanup();
+
+    {
+        auto sink = RotatingFileSink::open(filename, 32, 2);
+        REQUIRE(sink.has_value());
+        sink->write("0123456789abcdef\n");  // 17 bytes
+        sink->write("second line 0001\n");  // would exceed 32, rotates
+        sink->write("third line 00002\n");  // rotates again
+        sink->write("fourth line 0003\n");  // oldest file is removed
+    }
+
+    CHECK(read_file(filename) == "fourth line 0003\n");
+    CHECK(read_file(filename + ".1") == "third line 00002\n");
+    CHECK(read_file(filename + ".2") == "second line 0001\n");
+    CHECK(read_file(filename + ".3").empty());
+    cleanup();
+}
+
+TEST_CASE("rotating file sink by age with compression") {
+    const std::string filename = "test_log_rotating_age.txt";
+    const auto cleanup = [&] {
+        std::remove(filename.c_str());
+        for (int i = 1; i <= 3; ++i) {
+            std::remove(std::format("{}.{}", filename, i).c_str());
+            std::remove(std::format("{}.{}.z", filename, i).c_str());
+            std::remove(std::format("{}.{}.gz", filename, i).c_str());
+        }
+    };
+    cleanup();
+
+    SUBCASE("custom compressor") {
+        // Stands in for a real compressor by renaming the file
+        const Compressor rename_compressor{".z", [](const std::string& path) -> std::expected<void, std::string> {
+                                               if (std::rename(path.c_str(), (path + ".z").c_str()) != 0) {
+                                                   return std::unexpected("rename failed");
+                                               }
+                                               return {};
+                                           }};
+        // The file ages only when the test says so
+        auto now = std::chrono::steady_clock::time_point{};
+        {
+            auto sink = RotatingFileSink::open(filename, {.max_age = std::chrono::milliseconds(20),
+                                                          .max_files = 2,
+                                                          .compressor = rename_compressor,
+                                                          .clock = [&now] { return now; }});
+            REQUIRE(sink.has_value());
+            sink->write("first\n");
+            now += std::chrono::milliseconds(19);
+            sink->write("still first\n");
+            now += std::chrono::milliseconds(1);
+            sink->write("second\n");
+            now += std::chrono::milliseconds(30);
+            sink->write("third\n");
+            now += std::chrono::milliseconds(30);
+            sink->write("fourth\n");
+        }
+
+        CHECK(read_file(filename) == "fourth\n");
+        CHECK(read_file(filename + ".1.z") == "third\n");
+        CHECK(read_file(filename + ".2.z") == "second\n");
+        CHECK(read_file(filename + ".1").empty());
+        CHECK(read_file(filename + ".3.z").empty());
+    }
+
+#ifndef _WIN32
+    SUBCASE("gzip through utils::process") {
+        {
+            auto sink = RotatingFileSink::open(
+                filename, {.max_size = 16, .max_files = 1, .compressor = process_compressor({"gzip", "-f"}, ".gz")});
+            REQUIRE(sink.has_value());
+            sink->write("0123456789abcdef\n");
+            sink->write("second file\n");
+        }
+
+        CHECK(read_file(filename) == "second file\n");
+        CHECK(read_file(filename + ".1").empty());
+        CHECK(read_file(filename + ".1.gz").starts_with("\x1f\x8b")); // gzip magic
+    }
+#endif // _WIN32
+
+    cleanup();
+}
+
+TEST_CASE("disabled calls do not evaluate their arguments") {
+    static_assert(min_level == LogLevel::DEBUG);
+
+    int evaluated = 0;
+    const auto side_effect = [&evaluated] { return ++evaluated; };
+
+    detail::logger::instance().set_log_level(LogLevel::ERROR);
+    testing::CaptureStderr();
+    DEBUG("skipped {}", side_effect());
+    INFO("skipped {}", side_effect());
+    WARNING("skipped {}", side_effect());
+    ERROR("shown {}", side_effect());
+    const std::string output = testing::GetCapturedStderr();
+
+    CHECK(evaluated == 1);
+    CHECK(output == "[ERROR] shown 1\n");
+
+    // Usable as a single statement
+    if (evaluated == 1) INFO("still skipped");
+    else ERROR("unreachable");
+}
+
+TEST_CASE("log categories") {
+    set_log_level(LogLevel::INFO);
+    CHECK(log_level() == LogLevel::INFO);
+
+    Category& net = category("net");
+    CHECK(&net == &category("net"));
+    CHECK(net.name() == "net");
+    CHECK(net.level() == LogLevel::INFO);
+
+    SUBCASE("categories follow the global level until overridden") {
+        set_log_level(LogLevel::WARNING);
+        CHECK(net.level() == LogLevel::WARNING);
+
+        set_category_level("net", LogLevel::DEBUG);
+        set_log_level(LogLevel::ERROR);
+        CHECK(net.level() == LogLevel::DEBUG);
+
+        reset_category_level("net");
+        CHECK(net.level() == LogLevel::ERROR);
+        set_log_level(LogLevel::INFO);
+        CHECK(net.level() == LogLevel::INFO);
+    }
+
+    SUBCASE("levels can be configured before first use") {
+        set_category_level("db", LogLevel::ERROR);
+        CHECK(category("db").level() == LogLevel::ERROR);
+        reset_category_level("db");
+    }
+
+    SUBCASE("category output") {
+        set_category_level("net", LogLevel::DEBUG);
+        set_category_level("db", LogLevel::ERROR);
+
+        testing::CaptureStderr();
+        DEBUG_CAT("net", "connected to {}", "localhost");
+        INFO_CAT("db", "skipped");
+        ERROR_CAT("db", "query failed: {}", 7);
+        DEBUG("global level still filters");
+        const std::string output = testing::GetCapturedStderr();
+
+        CHECK(output.find("[DEBUG] [net] [") != std::string::npos);
+        CHECK(output.find("] connected to localhost\n") != std::string::npos);
+        CHECK(output.find("skipped") == std::string::npos);
+        CHECK(output.find("[ERROR] [db] query failed: 7\n") != std::string::npos);
+        CHECK(output.find("global level") == std::string::npos);
+
+        testing::CaptureStderr();
+        start_async();
+        WARNING_CAT("net", "async {}", std::string("category"));
+        stop_async();
+        CHECK(testing::GetCapturedStderr() == "[WARNING] [net] async category\n");
+
+        reset_category_level("net");
+        reset_category_level("db");
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("binary file sink round trip") {
+    const std::string filename = "test_log_binary.bin";
+    set_log_level(LogLevel::DEBUG);
+
+    {
+        auto sink = BinaryFileSink::open(filename, 4096);
+        REQUIRE(sink.has_value());
+        set_binary_sink(MOVE(*sink));
+    }
+
+    start_async();
+    for (int i = 0; i < 1000; ++i) INFO("record {} of {:>5}", i, 1000);
+    WARNING("mixed {1} {0} {2:.3f} {3} {4} {{escaped}}", std::string("text"), 'c', 2.5, true, -7);
+    DEBUG_CAT("bin", "debug {:#x}", u8{255});
+    ERROR("unsigned {} pointer {}", u64{1} << 40, nullptr);
+    stop_async();
+    reset_binary_sink();
+    set_log_level(LogLevel::INFO);
+
+    const std::string data = read_file(filename);
+    CHECK(data.starts_with(BinaryFileSink::magic));
+
+    RingSink ring(1 << 20);
+    const auto result = decode_binary(data, ring);
+    REQUIRE(result.has_value());
+    const std::string decoded = ring.contents();
+
+    CHECK(count_occurrences(decoded, "[INFO] record") == 1000);
+    CHECK(decoded.find("[INFO] record 999 of  1000\n") != std::string::npos);
+    CHECK(decoded.find("[WARNING] mixed c text 2.500 true -7 {escaped}\n") != std::string::npos);
+    CHECK(decoded.find("[DEBUG] [bin] [") != std::string::npos);
+    CHECK(decoded.find("] debug 0xff\n") != std::string::npos);
+    CHECK(decoded.find("[ERROR] unsigned 1099511627776 pointer 0x0\n") != std::string::npos);
+
+    // Every line starts with a "YYYY-MM-DD HH:MM:SS.nnnnnnnnn " timestamp
+    CHECK(decoded[4] == '-');
+    CHECK(decoded[19] == '.');
+    CHECK(decoded[29] == ' ');
+
+    CHECK(!decode_binary("not a log file", ring).has_value());
+    CHECK(!decode_binary(std::string_view(data).substr(0, data.size() - 3), ring).has_value());
+    std::remove(filename.c_str());
+}
+
+TEST_CASE("binary arguments are validated") {
+    const auto type = [](const detail::ArgType arg_type) { return std::string(1, static_cast<char>(arg_type)); };
+    const auto bytes = [](const auto value) {
+        std::string result(sizeof(value), '\0');
+        std::memcpy(result.data(), &value, sizeof(value));
+        return result;
+    };
+    const std::string i32_type = type(detail::ArgType::I32);
+    const std::string string_type = type(detail::ArgType::String);
+    std::string out;
+
+    const std::string args = bytes(i32{42}) + bytes(std::size_t{2}) + "ok";
+    CHECK(detail::format_binary_message(out, "{} {}", i32_type + string_type, args));
+    CHECK(out == "42 ok");
+
+    // Arguments missing entirely or cut short
+    CHECK(!detail::format_binary_message(out, "{}", i32_type, ""));
+    CHECK(!detail::format_binary_message(out, "{} {}", i32_type + i32_type, bytes(i32{1})));
+    CHECK(!detail::format_binary_message(out, "{}", i32_type, bytes(i16{1})));
+    CHECK(!detail::format_binary_message(out, "{}", string_type, bytes(u32{1})));
+    CHECK(!detail::format_binary_message(out, "{}", string_type, bytes(std::size_t{5}) + "four"));
+
+    // A length that would wrap around when the size of the length is added to it
+    constexpr std::size_t max = std::numeric_limits<std::size_t>::max();
+    CHECK(!detail::format_binary_message(out, "{}", string_type, bytes(max) + "x"));
+    CHECK(!detail::format_binary_message(out, "{}", string_type, bytes(max - 7) + "x"));
+
+    // An empty custom argument is not malformed
+    out.clear();
+    CHECK(detail::format_binary_message(out, "[{}]", type(detail::ArgType::Custom) + bytes(u32{0}), ""));
+    CHECK(out == "[<0 bytes>]");
+}
+#endif // _WIN32
+
+TEST_CASE("timestamp formatting") {
+    std::string out;
+    detail::append_timestamp(out, 0, 0);
+    CHECK(out == "1970-01-01 00:00:00");
+
+    out.clear();
+    detail::append_timestamp(out, 951'782'400'123'456'789, 9); // leap day
+    CHECK(out == "2000-02-29 00:00:00.123456789");
+
+    out.clear();
+    detail::append_timestamp(out, 1'767'225'599'999'000'000, 3);
+    CHECK(out == "2025-12-31 23:59:59.999");
+
+    out.clear();
+    detail::append_timestamp(out, -1'000'000, 6);
+    CHECK(out == "1969-12-31 23:59:59.999000");
+}
+
+TEST_CASE("cached timestamps") {
+    detail::TimestampCache cache;
+    std::string out;
+    cache.append(out, 951'782'400'123'456'789, 9);
+    CHECK(out == "2000-02-29 00:00:00.123456789");
+
+    out.clear();
+    cache.append(out, 951'782'400'987'000'000, 3);
+    CHECK(out == "2000-02-29 00:00:00.987");
+
+    out.clear();
+    cache.append(out, 951'782'401'000'001'000, 6);
+    CHECK(out == "2000-02-29 00:00:01.000001");
+
+    out.clear();
+    cache.append(out, -1'000'000, 0);
+    CHECK(out == "1969-12-31 23:59:59");
+
+    const auto system_ns = [] {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    };
+    const i64 before = system_ns();
+    const i64 fast = detail::FastClock::instance().now();
+    const i64 after = system_ns();
+    CHECK(fast >= before - 10'000'000);
+    CHECK(fast <= after + 10'000'000);
+}
+
+TEST_CASE("timestamp prefix") {
+    const RingSink ring(1024);
+    set_sink(ring);
+
+    set_timestamp_precision(TimestampPrecision::Milliseconds);
+    INFO("stamped");
+    // "YYYY-MM-DD HH:MM:SS.mmm [INFO] stamped"
+    std::string line = ring.contents();
+    CHECK(line.size() == 24 + std::strlen("[INFO] stamped\n"));
+    CHECK(line[19] == '.');
+    CHECK(line.substr(23) == " [INFO] stamped\n");
+
+    ring.clear();
+    start_async();
+    set_timestamp_precision(TimestampPrecision::Seconds);
+    INFO("async {}", 1);
+    stop_async();
+    line = ring.contents();
+    CHECK(line[10] == ' ');
+    CHECK(line.substr(19) == " [INFO] async 1\n");
+
+    ring.clear();
+    set_timestamp_precision(TimestampPrecision::None);
+    INFO("plain");
+    CHECK(ring.contents() == "[INFO] plain\n");
+
+    set_sink(StderrSink{});
+}
+
+TEST_CASE("rate limited logging") {
+    const RingSink ring(16384);
+    set_sink(ring);
+    set_log_level(LogLevel::DEBUG);
+
+    int evaluated = 0;
+    const auto count = [&evaluated] { return ++evaluated; };
+    for (int i = 0; i < 10; ++i) ERROR_EVERY_N(4, "every {}", count());
+    CHECK(count_occurrences(ring.contents(), "every") == 3); // calls 0, 4 and 8
+    CHECK(evaluated == 3);
+
+    ring.clear();
+    for (int i = 0; i < 10; ++i) INFO_FIRST_N(2, "first {}", i);
+    CHECK(ring.contents() == "[INFO] first 0\n[INFO] first 1\n");
+
+    ring.clear();
+    for (int i = 0; i < 10; ++i) WARNING_EVERY_MS(60'000, "throttled {}", i);
+    CHECK(ring.contents() == "[WARNING] throttled 0\n");
+
+    ring.clear();
+    for (int i = 0; i < 100; ++i) {
+        INFO_SAMPLE(0.0, "never");
+        DEBUG_SAMPLE(1.0, "always");
+    }
+    CHECK(count_occurrences(ring.contents(), "never") == 0);
+    CHECK(count_occurrences(ring.contents(), "always") == 100);
+
+    detail::Sample sample;
+    int passed = 0;
+    for (int i = 0; i < 10000; ++i) passed += sample(0.25) ? 1 : 0;
+    CHECK(passed > 2000);
+    CHECK(passed < 3000);
+
+    // Suppressed by the level, the gate is not consulted
+    set_log_level(LogLevel::ERROR);
+    ring.clear();
+    for (int i = 0; i < 3; ++i) {
+        if (i == 2) set_log_level(LogLevel::INFO);
+        INFO_FIRST_N(1, "shown {}", i);
+    }
+    CHECK(ring.contents() == "[INFO] shown 2\n");
+
+    set_sink(StderrSink{});
+}
+
+namespace {
+
+struct VectoredCountingSink {
+    struct State {
+        std::string output;
+        int writes = 0;
+        int vectored_writes = 0;
+    };
+
+    void write(const std::string_view data) const {
+        state->output += data;
+        ++state->writes;
+    }
+
+    void write_v(const std::span<const std::string_view> pieces) const {
+        for (const std::string_view piece : pieces) state->output += piece;
+        ++state->vectored_writes;
+    }
+
+    static void flush() noexcept {}
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+
+} // namespace
+
+TEST_CASE("buffered writes and flush") {
+    const VectoredCountingSink sink;
+    set_sink(sink);
+
+    SUBCASE("lines are held until flush") {
+        enable_buffering({.max_bytes = std::size_t{1} << 20, .max_delay = std::chrono::hours(1)});
+        for (int i = 0; i < 100; ++i) INFO("buffered {}", i);
+        CHECK(sink.state->output.empty());
+
+        flush();
+        CHECK(count_occurrences(sink.state->output, "[INFO] buffered") == 100);
+        CHECK(sink.state->writes == 0);
+        CHECK(sink.state->vectored_writes == 1);
+    }
+
+    SUBCASE("size threshold") {
+        enable_buffering({.max_bytes = 64, .max_delay = std::chrono::hours(1)});
+        for (int i = 0; i < 20; ++i) INFO("line {}", i);
+        CHECK(sink.state->vectored_writes > 1);
+        CHECK(sink.state->vectored_writes < 20);
+    }
+
+    SUBCASE("async records are drained by flush") {
+        enable_buffering({.max_bytes = std::size_t{1} << 20, .max_delay = std::chrono::hours(1)});
+        start_async();
+        for (int i = 0; i < 100; ++i) INFO("async {}", i);
+        flush();
+        CHECK(count_occurrences(sink.state->output, "[INFO] async") == 100);
+        stop_async();
+    }
+
+    SUBCASE("disable writes the rest") {
+        enable_buffering();
+        INFO("pending");
+        disable_buffering();
+        CHECK(sink.state->output == "[INFO] pending\n");
+        INFO("direct");
+        CHECK(sink.state->writes == 1);
+    }
+
+    disable_buffering();
+    set_sink(StderrSink{});
+}
+
+TEST_CASE("vectored fd writes") {
+    const std::string filename = "test_log_vectored.txt";
+    std::remove(filename.c_str());
+    {
+        auto sink = FdSink::open(filename);
+        REQUIRE(sink.has_value());
+        std::vector<std::string_view> pieces{"one ", "", "two ", "three\n"};
+        sink->write_v(pieces);
+    }
+    CHECK(read_file(filename) == "one two three\n");
+    std::remove(filename.c_str());
+}
+
+#ifndef _WIN32
+TEST_CASE("crash handler reports and flushes") {
+    const std::string filename = "test_log_crash.txt";
+    const std::string report_filename = "test_log_crash_report.txt";
+    std::remove(filename.c_str());
+    std::remove(report_filename.c_str());
+
+    const auto run_child = [&](const auto& crash) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            auto sink = FdSink::open(filename);
+            auto report = FdSink::open(report_filename);
+            if (!sink || !report) _exit(1);
+            set_sink(MOVE(*sink));
+            enable_buffering({.max_bytes = std::size_t{1} << 20, .max_delay = std::chrono::hours(1)});
+            install_crash_handler({.fd = report->fd()});
+            INFO("last words");
+            crash();
+            _exit(0);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return status;
+    };
+
+    std::string reason;
+    SUBCASE("ASSERT") {
+        const int status = run_child([] { ASSERT(false, "crash test"); });
+        CHECK(WIFSIGNALED(status));
+        reason = "*** Crash: ASSERT or TODO failed ***";
+    }
+
+    SUBCASE("fatal signal") {
+        const int status = run_child([] { std::raise(SIGSEGV); });
+        CHECK(WIFSIGNALED(status));
+        reason = "*** Crash: SIGSEGV ***";
+    }
+
+    CHECK(read_file(filename) == "[INFO] last words\n");
+
+    const std::string report = read_file(report_filename);
+    CHECK(count_occurrences(report, "*** Crash:") == 1);
+    CHECK(report.find(reason) != std::string::npos);
+    CHECK(report.find("Recent log output:\n[INFO] last words\n*** End of crash report ***") != std::string::npos);
+#if UTILS_LOG_HAS_BACKTRACE
+    CHECK(report.find("Backtrace:\n") != std::string::npos);
+#endif
+
+    std::remove(filename.c_str());
+    std::remove(report_filename.c_str());
+}
+#endif // _WIN32
+
+#ifndef _WIN32
+TEST_CASE("buffered lines are written before an ASSERT message") {
+    const std::string filename = "test_log_assert_order.txt";
+    std::remove(filename.c_str());
+
+    const pid_t pid = fork();
+    if (pid == 0) {
+        const std::FILE* file = std::freopen(filename.c_str(), "w", stderr);
+        if (file == nullptr) _exit(1);
+        set_sink(StderrSink{});
+        enable_buffering({.max_bytes = std::size_t{1} << 20, .max_delay = std::chrono::hours(1)});
+        INFO("before the assert");
+        ASSERT(false, "order test");
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFSIGNALED(status));
+
+    const std::string output = read_file(filename);
+    CHECK(output.starts_with("[INFO] before the assert\nAssert failed at ["));
+    CHECK(output.ends_with("order test\n"));
+    std::remove(filename.c_str());
+}
+#endif // _WIN32
+
+TEST_CASE("structured key-value logging") {
+    const RingSink ring(4096);
+    set_sink(ring);
+
+    SUBCASE("logfmt") {
+        set_kv_format(KvFormat::Logfmt);
+        INFO_KV("user logged in", "user", 42, "admin", false, "ratio", 0.5, "name", "a=b", "empty", "");
+        CHECK(ring.contents() ==
+              "level=INFO msg=\"user logged in\" user=42 admin=false ratio=0.5 name=\"a=b\" empty=\"\"\n");
+
+        ring.clear();
+        WARNING_KV("quote\"and\nnewline", "path", std::string("/tmp/x"), "none", nullptr);
+        CHECK(ring.contents() == "level=WARNING msg=\"quote\\\"and\\nnewline\" path=/tmp/x none=null\n");
+
+        // Keys are escaped the same way, so they cannot inject fields
+        ring.clear();
+        INFO_KV("keys", "a b", 1, "x=y", 2, "", 3);
+        CHECK(ring.contents() == "level=INFO msg=keys \"a b\"=1 \"x=y\"=2 \"\"=3\n");
+    }
+
+    SUBCASE("json") {
+        set_kv_format(KvFormat::Json);
+        ERROR_KV("failed", "code", -3, "tab", "a\tb", "ctrl", std::string_view("\x01", 1), "nan", std::nan(""));
+        CHECK(ring.contents() ==
+              "{\"level\":\"ERROR\",\"msg\":\"failed\",\"code\":-3,\"tab\":\"a\\tb\",\"ctrl\":\"\\u0001\","
+              "\"nan\":null}\n");
+
+        ring.clear();
+        set_log_level(LogLevel::DEBUG);
+        DEBUG_KV("debug", "c", 'x');
+        set_log_level(LogLevel::INFO);
+        const std::string line = ring.contents();
+        CHECK(line.starts_with("{\"level\":\"DEBUG\",\"caller\":\""));
+        CHECK(line.ends_with("\"msg\":\"debug\",\"c\":\"x\"}\n"));
+    }
+
+    SUBCASE("async with timestamps") {
+        set_kv_format(KvFormat::Json);
+        set_timestamp_precision(TimestampPrecision::Seconds);
+        start_async();
+        INFO_KV("async", "n", 1);
+        stop_async();
+        set_timestamp_precision(TimestampPrecision::None);
+        const std::string line = ring.contents();
+        CHECK(line.starts_with("{\"ts\":\""));
+        CHECK(line.ends_with("\",\"level\":\"INFO\",\"msg\":\"async\",\"n\":1}\n"));
+    }
+
+    SUBCASE("filtered by level") {
+        int evaluated = 0;
+        DEBUG_KV("hidden", "n", ++evaluated);
+        CHECK(evaluated == 0);
+        CHECK(ring.contents().empty());
+    }
+
+    set_kv_format(KvFormat::Logfmt);
+    set_sink(StderrSink{});
+}
+
+TEST_CASE("trace spans") {
+    const RingSink ring(16384);
+
+    {
+        TRACE_SCOPE("before tracing");
+    }
+
+    set_trace_sink(ring);
+    {
+        TRACE_SCOPE("outer");
+        TRACE_SCOPE("inner \"quoted\"");
+    }
+    std::thread([] { TRACE_SCOPE("worker"); }).join();
+    flush_trace();
+
+    std::string trace = ring.contents();
+    CHECK(trace.starts_with("[\n{\"name\":"));
+    CHECK(count_occurrences(trace, "\"ph\":\"X\"") == 3);
+    CHECK(trace.find("\"name\":\"outer\"") != std::string::npos);
+    CHECK(trace.find("\"name\":\"inner \\\"quoted\\\"\"") != std::string::npos);
+    CHECK(trace.find("\"name\":\"worker\"") != std::string::npos);
+    CHECK(trace.find("before tracing") == std::string::npos);
+
+    {
+        TRACE_SCOPE("after flush");
+    }
+    close_trace();
+    {
+        TRACE_SCOPE("after close");
+    }
+    flush_trace();
+
+    trace = ring.contents();
+    CHECK(count_occurrences(trace, "\"ph\":\"X\"") == 4);
+    CHECK(trace.find("},\n{\"name\":\"after flush\"") != std::string::npos);
+    CHECK(trace.ends_with("}\n]\n"));
+
+    // A span still open when its trace is closed does not end up in the next trace
+    const RingSink next(16384);
+    set_trace_sink(ring);
+    {
+        TRACE_SCOPE("across traces");
+        close_trace();
+        set_trace_sink(next);
+    }
+    close_trace();
+
+    CHECK(next.contents() == "[\n\n]\n");
+}
@@ -3,6 +3,24 @@
 
 #include "string.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif // _WIN32
+
 using namespace utils::string;
 
 TEST_CASE("ASCII checks") {
@@ -101,6 +119,155 @@ TEST_CASE("ASCII checks") {
     CHECK(ascii::to_upper(c8) == '@');
 }
 
+TEST_CASE("ASCII bulk operations") {
+    // Every byte value, at every offset and length around the vector widths
+    std::string bytes;
+    for (int i = 0; i < 256; ++i) bytes += static_cast<char>(i);
+    bytes += bytes;
+
+    const auto reference_find = [](const std::string_view str, bool (*predicate)(char)) -> std::size_t {
+        for (std::size_t i = 0; i < str.size(); ++i) {
+            if (!predicate(str[i])) return i;
+        }
+        return std::string_view::npos;
+    };
+
+    for (std::size_t offset = 0; offset < bytes.size(); offset += 61) {
+        for (const std::size_t length : std::array<std::size_t, 11>{0, 1, 15, 16, 17, 31, 32, 33, 64, 100, 256}) {
+            const std::string_view str = std::string_view(bytes).substr(offset, length);
+
+            std::string lower(str.size(), '\0');
+            std::string upper(str.size(), '\0');
+            ascii::to_lower(str, lower.data());
+            ascii::to_upper(str, upper.data());
+            for (std::size_t i = 0; i < str.size(); ++i) {
+                CHECK(lower[i] == ascii::to_lower(str[i]));
+                CHECK(upper[i] == ascii::to_upper(str[i]));
+            }
+
+            std::string in_place(str);
+            ascii::to_lower_in_place(in_place);
+            CHECK(in_place == lower);
+            ascii::to_upper_in_place(in_place);
+            CHECK(in_place == upper);
+        }
+
+        // Runs of class members followed by every other byte
+        for (const char c : bytes.substr(0, 256)) {
+            const auto run = [&](const std::string& members) {
+                std::string str;
+                while (str.size() < offset % 70) str += members;
+                return str + c + members;
+            };
+            const std::string digits = run("0123456789");
+            const std::string alnum = run("azAZ09");
+            const std::string hex = run("09afAF");
+            const std::string spaces = run(" \t\n\v\f\r");
+            const std::string alpha = run("azAZ");
+            CHECK(ascii::find_first_non_digit(digits) == reference_find(digits, ascii::is_digit<char>));
+            CHECK(ascii::find_first_non_alnum(alnum) == reference_find(alnum, ascii::is_alnum<char>));
+            CHECK(ascii::find_first_non_hex_digit(hex) == reference_find(hex, ascii::is_hex_digit<char>));
+            CHECK(ascii::find_first_non_space(spaces) == reference_find(spaces, ascii::is_space<char>));
+            CHECK(ascii::find_first_non_alpha(alpha) == reference_find(alpha, ascii::is_alpha<char>));
+        }
+    }
+
+    CHECK(ascii::all_of_alnum("Content-Type") == false);
+    CHECK(ascii::all_of_alnum("ContentType42"));
+    CHECK(ascii::all_of_digit(""));
+    CHECK(ascii::all_of_digit("01234567890123456789012345678901234567890123456789"));
+    CHECK(ascii::find_first_non_digit("01234567890123456789012345678901234567890123456789x") == 50);
+    CHECK(ascii::all_of_hex_digit("DEADbeef0123"));
+    CHECK(ascii::all_of_space(" \t\r\n"));
+    CHECK(ascii::all_of_alpha("abcXYZ"));
+
+    static_assert(ascii::find_first_non_digit("123abc") == 3);
+    static_assert([] {
+        std::array<char, 5> out{};
+        ascii::to_upper("aBc1", out.data());
+        return std::string_view(out.data()) == "ABC1";
+    }());
+}
+
+TEST_CASE("case-insensitive comparison and hashing") {
+    CHECK(iequals("Content-Type", "content-type"));
+    CHECK(iequals("CONTENT-TYPE", "content-type"));
+    CHECK(!iequals("Content-Type", "content-typo"));
+    CHECK(!iequals("Content-Type", "content-type "));
+    CHECK(iequals("", ""));
+    CHECK(!iequals("@[`{", "`{@["));            // neighbours of the letters do not fold
+    CHECK(!iequals("\xc1\xe1", "\xe1\xc1")); // neither do bytes above 0x7f
+
+    CHECK(icompare("apple", "Banana") == std::strong_ordering::less);
+    CHECK(icompare("APPLE", "apple") == std::strong_ordering::equal);
+    CHECK(icompare("apple", "APP") == std::strong_ordering::greater);
+    CHECK(icompare("a_", "AB") == std::strong_ordering::less); // '_' < 'b', although '_' > 'B'
+
+    const auto lower = [](const std::string_view str) {
+        std::string result(str.size(), '\0');
+        for (std::size_t i = 0; i < str.size(); ++i) result[i] = ascii::to_lower(str[i]);
+        return result;
+    };
+    const auto reference_compare = [&](const std::string_view lhs, const std::string_view rhs) {
+        const std::string a = lower(lhs);
+        const std::string b = lower(rhs);
+        const int result = std::char_traits<char>::compare(a.data(), b.data(), std::min(a.size(), b.size()));
+        if (result != 0) return result <=> 0;
+        return a.size() <=> b.size();
+    };
+
+    u32 state = 88172645;
+    const auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+    const auto random_string = [&](const std::size_t size) {
+        std::string str;
+        for (std::size_t i = 0; i < size; ++i) {
+            const u32 r = next();
+            str += r % 8 == 0 ? static_cast<char>(r >> 8) : static_cast<char>("aBzZ@[`{-09"[(r >> 8) % 11]);
+        }
+        return str;
+    };
+
+    for (int i = 0; i < 3000; ++i) {
+        const std::string a = random_string(next() % 40);
+        std::string b = i % 2 == 0 ? random_string(next() % 40) : a;
+        // Flip the case of some letters, and sometimes change one byte
+        for (char& c : b) {
+            if (next() % 2 == 0) c = ascii::is_lower(c) ? ascii::to_upper(c) : ascii::to_lower(c);
+        }
+        if (i % 4 == 1 && !b.empty()) b[next() % b.size()] = static_cast<char>(next());
+
+        CAPTURE(a);
+        CAPTURE(b);
+        CHECK(iequals(a, b) == (lower(a) == lower(b)));
+        CHECK(icompare(a, b) == reference_compare(a, b));
+        if (lower(a) == lower(b)) CHECK(ihash{}(a) == ihash{}(b));
+        CHECK(ihash{}(a) == ihash{}(lower(a)));
+    }
+
+    // Shorter strings and zero bytes do not collide with each other
+    CHECK(ihash{}("") != ihash{}(std::string_view("\0", 1)));
+    CHECK(ihash{}("abc") != ihash{}("abcd"));
+
+    std::unordered_map<std::string, int, ihash, iequal_to> headers{{"Content-Type", 1}, {"X-Request-Id", 2}};
+    CHECK(headers.find(std::string_view("content-type"))->second == 1);
+    CHECK(headers.find("X-REQUEST-ID")->second == 2);
+    CHECK(headers.find(std::string_view("Content-Length")) == headers.end());
+    CHECK(headers.contains("x-request-id"));
+
+    static_assert(iequals("Transfer-Encoding", "transfer-encoding"));
+    static_assert(icompare("abc", "ABD") == std::strong_ordering::less);
+    static_assert(ihash{}("Host") == ihash{}("host"));
+
+    // Same hashes at compile time and at runtime
+    constexpr std::size_t compile_time = ihash{}("Accept-Encoding: gzip, deflate");
+    CHECK(ihash{}(std::string("accept-encoding: GZIP, DEFLATE")) == compile_time);
+}
+
 TEST_CASE("trimming") {
     std::string str = "  Hello, World!  ";
     CHECK(trim(str, TrimMode::Left) == "Hello, World!  ");
@@ -174,6 +341,90 @@ TEST_CASE("trimming") {
     CHECK(str10 == "Hello, Wor ld!");
 }
 
+TEST_CASE("trimming long strings") {
+    // Scalar versions of the kernels to compare against
+    const auto reference_trim = [](const std::string_view str, const TrimMode mode) {
+        std::size_t start = 0;
+        std::size_t end = str.size();
+        if (mode != TrimMode::Right) {
+            while (start < end && ascii::is_space(str[start])) ++start;
+        }
+        if (mode != TrimMode::Left) {
+            while (end > start && ascii::is_space(str[end - 1])) --end;
+        }
+        return std::string(str.substr(start, end - start));
+    };
+    const auto reference_reduce = [](const std::string_view str) {
+        std::string result;
+        bool in_ws_seq = true;
+        for (const char c : str) {
+            if (!ascii::is_space(c)) {
+                result += c;
+                in_ws_seq = false;
+            } else if (!in_ws_seq) {
+                result += ' ';
+                in_ws_seq = true;
+            }
+        }
+        if (!result.empty() && result.back() == ' ') result.pop_back();
+        return result;
+    };
+
+    // Mostly words and single spaces, with runs of other whitespace, high bytes and NULs
+    const std::string alphabet = std::string("abc  \t\n\v\f\r\x80\xa0\x89\x8d") + '\0';
+    u32 state = 12345;
+    const auto next = [&state] {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    };
+
+    for (int i = 0; i < 2000; ++i) {
+        const std::size_t size = next() % 300;
+        const u32 spaces = next() % 4;
+        std::string str;
+        for (std::size_t j = 0; j < size; ++j) {
+            const u32 r = next();
+            str += r % 4 < spaces ? alphabet[r % alphabet.size()] : static_cast<char>('a' + r % 26);
+        }
+        if (i % 3 == 0) str = std::string(next() % 100, ' ') + str + std::string(next() % 100, '\t');
+        CAPTURE(str);
+
+        for (const auto mode : {TrimMode::Left, TrimMode::Right, TrimMode::Both}) {
+            const std::string expected = reference_trim(str, mode);
+            CHECK(trim(str, mode) == expected);
+            CHECK(trim_view(str, mode) == expected);
+        }
+        CHECK(trim_and_reduce(str) == reference_reduce(str));
+    }
+
+    const std::string padded = std::string(200, ' ') + "x" + std::string(200, '\n');
+    CHECK(trim_view(padded).data() == padded.data() + 200);
+    CHECK(trim_view(std::string(150, ' ')).empty());
+
+#if defined(UTILS_STRING_DISPATCH_AVX2)
+    // Both sides of the runtime dispatch agree with ascii::is_space on every byte
+    std::array<char, 256> bytes{};
+    for (std::size_t i = 0; i < bytes.size(); ++i) bytes[i] = static_cast<char>(i);
+    for (std::size_t offset = 0; offset < bytes.size(); offset += 64) {
+        const auto sse2 = detail::simd::space_masks_sse2(bytes.data() + offset);
+        for (std::size_t i = 0; i < 64; ++i) {
+            CHECK(((sse2.space >> i) & 1) == ascii::is_space(bytes[offset + i]));
+            CHECK(((sse2.blank >> i) & 1) == (bytes[offset + i] == ' '));
+        }
+        if (detail::simd::has_avx2()) {
+            const auto avx2 = detail::simd::space_masks_avx2(bytes.data() + offset);
+            CHECK(avx2.space == sse2.space);
+            CHECK(avx2.blank == sse2.blank);
+        }
+    }
+#endif
+
+    static_assert(trim_view("  a b  ") == "a b");
+    static_assert(trim_view("  a b  ", TrimMode::Left) == "a b  ");
+}
+
 TEST_CASE("replacing") {
     std::string str = "Hello, World!";
     CHECK(replace_all(str, "Hello", "Hi") == "Hi, World!");
@@ -197,6 +448,103 @@ TEST_CASE("replacing") {
     CHECK(str3 == "Hello, World!");
 }
 
+TEST_CASE("replacing long strings") {
+    // The old one replacement at a time algorithm, to compare against
+    const auto reference = [](std::string str, const std::string_view from, const std::string_view to) {
+        for (std::size_t pos = 0; (pos = str.find(from, pos)) != std::string::npos; pos += to.size()) {
+            str.replace(pos, from.size(), to);
+        }
+        return str;
+    };
+
+    std::string text;
+    for (int i = 0; i < 200; ++i) text += i % 7 == 0 ? "<b>aaa</b> " : "ab&c abca ";
+    for (const std::string_view from : {"a", "aa", "ab", "abc", "<b>", "</b> ", "zz", "ab&c abca ab&c abca "}) {
+        for (const std::string_view to : {"", "x", "xy", "&amp;", "longer replacement"}) {
+            for (std::size_t offset = 0; offset < 40; offset += 7) {
+                const std::string input = text.substr(offset);
+                CAPTURE(from);
+                CAPTURE(to);
+                CHECK(replace_all(input, from, to) == reference(input, from, to));
+            }
+        }
+    }
+
+    CHECK(replace_all("aaaa", "aa", "a") == "aa");
+    CHECK(replace_all("abc", "", "x") == "abc");
+}
+
+TEST_CASE("replacing several patterns") {
+    CHECK(replace_all("<a href=\"x\">&</a>", {{"<", "&lt;"}, {">", "&gt;"}, {"&", "&amp;"}, {"\"", "&quot;"}}) ==
+          "&lt;a href=&quot;x&quot;&gt;&amp;&lt;/a&gt;");
+
+    // Replaced text is not searched again, unlike chained replace_all calls
+    CHECK(replace_all("ab", {{"a", "b"}, {"b", "c"}}) == "bc");
+
+    // Leftmost match first, then the longest one
+    CHECK(replace_all("abcd", {{"bc", "1"}, {"abcd", "2"}}) == "2");
+    CHECK(replace_all("abcd", {{"bcd", "1"}, {"ab", "2"}}) == "2cd");
+    CHECK(replace_all("abcde", {{"b", "1"}, {"bcd", "2"}, {"bc", "3"}}) == "a2e");
+    CHECK(replace_all("aaaa", {{"aa", "x"}, {"aaa", "y"}}) == "ya");
+    CHECK(replace_all("she sells", {{"he", "1"}, {"she", "2"}, {"hers", "3"}, {"s", "4"}}) == "2 4ell4");
+
+    // Duplicates keep the first replacement and empty patterns are ignored
+    CHECK(replace_all("aba", {{"a", "1"}, {"a", "2"}, {"", "3"}}) == "1b1");
+    CHECK(replace_all("", {{"a", "1"}}).empty());
+    CHECK(replace_all("text", {}) == "text");
+
+    const Replacer sanitize{{"\r\n", "\n"}, {"\t", "    "}, {std::string_view("\0", 1), ""}};
+    CHECK(sanitize.replace(std::string_view("a\r\nb\tc\0d\r", 10)) == "a\nb    cd\r");
+
+    SUBCASE("same as a naive leftmost longest search") {
+        const auto reference = [](const std::string_view str, const std::vector<Replacer::Replacement>& patterns) {
+            std::string result;
+            for (std::size_t i = 0; i < str.size();) {
+                const Replacer::Replacement* best = nullptr;
+                for (const auto& pattern : patterns) {
+                    if (!pattern.first.empty() && str.substr(i).starts_with(pattern.first) &&
+                        (best == nullptr || pattern.first.size() > best->first.size())) {
+                        best = &pattern;
+                    }
+                }
+                if (best == nullptr) {
+                    result += str[i++];
+                } else {
+                    result += best->second;
+                    i += best->first.size();
+                }
+            }
+            return result;
+        };
+
+        std::string text;
+        u32 state = 2463534242U;
+        for (int i = 0; i < 3000; ++i) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            text += static_cast<char>('a' + state % 6);
+        }
+
+        const std::vector<std::vector<Replacer::Replacement>> pattern_sets = {
+            {{"ab", "X"}, {"abc", "Y"}, {"bca", "Z"}},
+            {{"a", ""}, {"b", "bb"}, {"c", "-"}, {"d", "dd"}, {"e", "E"}, {"ff", "F"}},
+            {{"abcabc", "1"}, {"cab", "2"}, {"aa", "3"}, {"aaa", "4"}, {"fed", "5"}, {"e", "6"}},
+        };
+        for (const auto& patterns : pattern_sets) {
+            CHECK(Replacer(patterns).replace(text) == reference(text, patterns));
+        }
+    }
+
+    SUBCASE("same as replace_all with a single pattern") {
+        std::string text;
+        for (int i = 0; i < 100; ++i) text += i % 3 == 0 ? "abab ba" : "aab b";
+        for (const std::string_view from : {"a", "ab", "aba", "b b", "aab"}) {
+            CHECK(replace_all(text, {{from, "<>"}}) == replace_all(text, from, "<>"));
+        }
+    }
+}
+
 TEST_CASE("splitting") {
     const std::string str = "Hello, World!";
     CHECK(split(str, ",") == std::vector<std::string>{"Hello", " World!"});
@@ -263,6 +611,317 @@ TEST_CASE("splitting with KeepEmpty") {
     CHECK(split(str5, "aaa", SplitBehavior::KeepEmpty) == std::vector<std::string>{"", "", "", ""});
 }
 
+TEST_CASE("splitting into views") {
+    const std::string str = "aaa,AAA,,bbb,BBB,ccc,CCC";
+    CHECK(split_view(str, ",") == std::vector<std::string_view>{"aaa", "AAA", "bbb", "BBB", "ccc", "CCC"});
+    CHECK(split_view(str, ",", SplitBehavior::KeepEmpty) ==
+          std::vector<std::string_view>{"aaa", "AAA", "", "bbb", "BBB", "ccc", "CCC"});
+    CHECK(split_view(str, ",,") == std::vector<std::string_view>{"aaa,AAA", "bbb,BBB,ccc,CCC"});
+    CHECK(split_view(str, "") == std::vector<std::string_view>{str});
+    CHECK(split_view("", ",").empty());
+
+    // Tokens point into the original string
+    const auto tokens = split_view(str, ",");
+    CHECK(tokens[1].data() == str.data() + 4);
+
+    SUBCASE("caller supplied buffer") {
+        std::array<std::string_view, 4> out{};
+        CHECK(split_view(str, ",", out) == 6);
+        CHECK(out == std::array<std::string_view, 4>{"aaa", "AAA", "bbb", "BBB"});
+
+        CHECK(split_view("x y", " ", out) == 2);
+        CHECK(out[0] == "x");
+        CHECK(out[1] == "y");
+    }
+
+    SUBCASE("same tokens as split") {
+        // Long inputs with delimiters on both sides of every vector boundary
+        std::string long_str;
+        for (int i = 0; i < 300; ++i) {
+            long_str += std::string(static_cast<std::size_t>(i % 37), static_cast<char>('a' + i % 26));
+            long_str += i % 5 == 0 ? ";;" : ";";
+        }
+
+        for (const std::string_view delimiter : {";", ";;", "a", "zz"}) {
+            for (const auto behavior : {SplitBehavior::Nothing, SplitBehavior::KeepEmpty}) {
+                for (std::size_t offset = 0; offset < 40; ++offset) {
+                    const std::string_view input = std::string_view(long_str).substr(offset);
+                    const auto expected = split(input, delimiter, behavior);
+                    const auto views = split_view(input, delimiter, behavior);
+                    REQUIRE(views.size() == expected.size());
+                    for (std::size_t i = 0; i < views.size(); ++i) CHECK(views[i] == expected[i]);
+                }
+            }
+        }
+    }
+
+    static_assert([] {
+        std::array<std::string_view, 3> out{};
+        return split_view("a|b||c", "|", out) == 3 && out[2] == "c";
+    }());
+}
+
+TEST_CASE("lazy splitting") {
+    static_assert(std::ranges::forward_range<SplitRange>);
+    static_assert(std::ranges::view<SplitRange>);
+    static_assert(std::ranges::borrowed_range<SplitRange>);
+
+    const auto collect = [](auto&& range) {
+        std::vector<std::string> result;
+        for (const std::string_view token : range) result.emplace_back(token);
+        return result;
+    };
+
+    SUBCASE("same tokens as split") {
+        const std::vector<std::string> inputs = {
+            "", ",", ",,", "a", "a,", ",a", "a,,b", "aaa,AAA,bbb,BBB,ccc,CCC", "aaaaBaaaBBBaaCaa", "aaaaaaaaa",
+            "Hello, World!", std::string(100, ',') + "x" + std::string(50, ','),
+        };
+        for (const auto& input : inputs) {
+            for (const std::string_view delimiter : {",", "", "a", "aa", "aaa", "Hello, World!", ", "}) {
+                for (const auto behavior : {SplitBehavior::Nothing, SplitBehavior::KeepEmpty}) {
+                    CAPTURE(input);
+                    CAPTURE(delimiter);
+                    CHECK(collect(split_range(input, delimiter, behavior)) == split(input, delimiter, behavior));
+                }
+            }
+        }
+    }
+
+    SUBCASE("pipelines") {
+        const std::string line = "id,,name,age,city,country";
+        auto first_two = split_range(line, ",") | std::views::take(2);
+        CHECK(collect(first_two) == std::vector<std::string>{"id", "name"});
+
+        auto long_fields = split_range(line, ",", SplitBehavior::KeepEmpty) |
+                           std::views::filter([](const std::string_view token) { return token.size() > 3; });
+        CHECK(collect(long_fields) == std::vector<std::string>{"name", "city", "country"});
+
+        // Iterators outlive the temporary range
+        const auto it = std::ranges::find(split_range(line, ","), "age");
+        REQUIRE(it != SplitRange::Iterator{});
+        CHECK(*std::next(it) == "city");
+
+        CHECK(std::ranges::distance(split_range(line, ",")) == 5);
+        CHECK(std::ranges::distance(split_range(line, ",", SplitBehavior::KeepEmpty)) == 6);
+    }
+
+    static_assert(std::ranges::distance(split_range("a|b||c", "|")) == 3);
+    static_assert(*std::ranges::next(split_range("a|b||c", "|", SplitBehavior::KeepEmpty).begin(), 3) == "c");
+}
+
+TEST_CASE("parsing numbers") {
+    // Same results as std::from_chars on the whole string, anything left over is invalid_argument
+    const auto check_like_from_chars = []<typename T>(const std::string_view str, const T) {
+        T expected{};
+        const auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), expected);
+        const auto parsed = parse<T>(str);
+        CAPTURE(str);
+        if (end != str.data() + str.size()) {
+            REQUIRE(!parsed.has_value());
+            CHECK(parsed.error() == std::errc::invalid_argument);
+        } else if (error != std::errc{}) {
+            REQUIRE(!parsed.has_value());
+            CHECK(parsed.error() == error);
+        } else {
+            REQUIRE(parsed.has_value());
+            CHECK(*parsed == expected);
+        }
+    };
+
+    const std::vector<std::string> inputs = {
+        "", "-", "0", "-0", "7", "-7", "+7", " 7", "7 ", "12345678", "123456789", "1234567812345678",
+        "00000000000000000000000000001", "127", "128", "-128", "-129", "255", "256", "32767", "32768", "-32769",
+        "65535", "65536", "2147483647", "2147483648", "-2147483648", "-2147483649", "4294967295", "4294967296",
+        "9223372036854775807", "9223372036854775808", "-9223372036854775808", "-9223372036854775809",
+        "18446744073709551615", "18446744073709551616", "99999999999999999999", "123456789012345678901234567890",
+        "1234a678", "12345678a", "1234567/", "1234567:", "--1", "0x10", "1e5", "12345678901234567x",
+    };
+    for (const auto& input : inputs) {
+        check_like_from_chars(input, i8{});
+        check_like_from_chars(input, u8{});
+        check_like_from_chars(input, i16{});
+        check_like_from_chars(input, u16{});
+        check_like_from_chars(input, i32{});
+        check_like_from_chars(input, u32{});
+        check_like_from_chars(input, i64{});
+        check_like_from_chars(input, u64{});
+    }
+
+    u64 state = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < 5000; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        const u64 value = state >> (state % 64);
+        check_like_from_chars(std::to_string(value), u64{});
+        check_like_from_chars(std::to_string(static_cast<i64>(value)), i64{});
+        check_like_from_chars(std::to_string(static_cast<i32>(value)), i32{});
+    }
+
+    CHECK(parse_hex<u32>("ff") == 255U);
+    CHECK(parse_hex<u32>("DeadBeef") == 0xDEADBEEFU);
+    CHECK(parse_hex<u64>("FFFFFFFFFFFFFFFF") == 0xFFFFFFFFFFFFFFFFULL);
+    CHECK(parse_hex<u64>("10000000000000000").error() == std::errc::result_out_of_range);
+    CHECK(parse_hex<u8>("100").error() == std::errc::result_out_of_range);
+    CHECK(parse_hex<i8>("-80") == -128);
+    CHECK(parse_hex<i8>("80").error() == std::errc::result_out_of_range);
+    CHECK(parse_hex<u32>("0x10").error() == std::errc::invalid_argument);
+    CHECK(parse_hex<u32>("fg").error() == std::errc::invalid_argument);
+    CHECK(parse_hex<u32>("").error() == std::errc::invalid_argument);
+
+    CHECK(parse<double>("2.5") == 2.5);
+    CHECK(parse<double>("-1e-3") == -1e-3);
+    CHECK(parse<double>("1e999").error() == std::errc::result_out_of_range);
+    CHECK(parse<float>("2.5x").error() == std::errc::invalid_argument);
+    CHECK(parse<double>("").error() == std::errc::invalid_argument);
+
+    static_assert(parse<int>("-12345678901") == std::unexpected(std::errc::result_out_of_range));
+    static_assert(parse<u64>("1234567812345678") == 1234567812345678ULL);
+    static_assert(parse_hex<u16>("beef") == 0xBEEF);
+}
+
+TEST_CASE("formatting numbers") {
+    std::array<char, max_chars<double>> buffer{};
+    CHECK(format_number(buffer, 0.1) == "0.1");
+    CHECK(format_number(buffer, -1.7976931348623157e308) == "-1.7976931348623157e+308");
+    CHECK(format_number(buffer, 5e-324) == "5e-324");
+    CHECK(format_number(buffer, 100.0) == "100");
+
+    std::array<char, max_chars<i64>> int_buffer{};
+    CHECK(format_number(int_buffer, std::numeric_limits<i64>::min()) == "-9223372036854775808");
+    CHECK(format_number(std::span<char>(buffer), std::numeric_limits<u64>::max()) == "18446744073709551615");
+
+    // Too small for the value, nothing of the buffer is returned
+    std::array<char, 3> short_buffer{};
+    CHECK(format_number(short_buffer, 123) == "123");
+    CHECK(format_number(short_buffer, 1234).empty());
+    CHECK(format_number(short_buffer, -100).empty());
+    CHECK(format_number(short_buffer, 0.125).empty());
+    CHECK(format_number(std::span<char>(), 0).empty());
+
+    // Shortest representations parse back to the same value
+    u64 state = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < 5000; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        const auto value = std::bit_cast<double>(state);
+        if (!std::isfinite(value)) continue;
+        CHECK(parse<double>(format_number(buffer, value)) == value);
+
+        const auto small = std::bit_cast<float>(static_cast<u32>(state));
+        if (!std::isfinite(small)) continue;
+        std::array<char, max_chars<float>> float_buffer{};
+        CHECK(parse<float>(format_number(float_buffer, small)) == small);
+    }
+}
+
+TEST_CASE("parsing many fields") {
+    std::vector<int> values(8);
+    const auto fields = split_range("1,-2,x,40000000000,5,,7", ",", SplitBehavior::KeepEmpty);
+    const auto result = parse_all<int>(fields, values);
+    CHECK(result.count == 7);
+    CHECK(values == std::vector<int>{1, -2, 0, 0, 5, 0, 7, 0});
+    REQUIRE(result.errors.size() == 3);
+    CHECK(result.errors[0].index == 2);
+    CHECK(result.errors[0].error == std::errc::invalid_argument);
+    CHECK(result.errors[1].index == 3);
+    CHECK(result.errors[1].error == std::errc::result_out_of_range);
+    CHECK(result.errors[2].index == 5);
+
+    // Stops when out is full
+    std::array<double, 2> doubles{};
+    const auto partial = parse_all<double>(split_view("0.5 1.5 2.5", " "), doubles);
+    CHECK(partial.count == 2);
+    CHECK(partial.errors.empty());
+    CHECK(doubles == std::array<double, 2>{0.5, 1.5});
+}
+
+TEST_CASE("building strings") {
+    SUBCASE("inline buffer") {
+        Builder<16> builder;
+        builder += "Hello";
+        builder += ',';
+        builder.format(" {}!", "World");
+        CHECK(builder.piece_count() == 1);
+        CHECK(builder.str() == "Hello, World!");
+        CHECK(builder.size() == 13);
+    }
+
+    SUBCASE("chunks come from the arena") {
+        // Every allocation past the buffer fails, so nothing can come from the heap
+        std::array<std::byte, 4096> buffer{};
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+        Builder<8> builder(&arena);
+
+        std::string expected;
+        for (int i = 0; i < 100; ++i) {
+            builder.format("{},", i);
+            expected += std::to_string(i) + ',';
+        }
+        builder.append(std::string(50, 'x'));
+        expected += std::string(50, 'x');
+        CHECK(builder.piece_count() > 2);
+        CHECK(builder.size() == expected.size());
+        CHECK(builder.str() == expected);
+
+        std::string joined;
+        builder.for_each_piece([&joined](const std::string_view piece) {
+            joined += piece;
+        });
+        CHECK(joined == expected);
+        const std::string_view first = builder.piece(0);
+        CHECK(first.size() <= 8);
+        CHECK(expected.starts_with(first));
+
+        // Reuses the chunks it already has
+        const char* chunk = builder.piece(1).data();
+        builder.clear();
+        CHECK(builder.empty());
+        builder.append(std::string(20, 'y'));
+        CHECK(builder.piece_count() == 2);
+        CHECK(builder.piece(1).data() == chunk);
+        CHECK(builder.str() == std::string(20, 'y'));
+    }
+
+    SUBCASE("format_to and moves") {
+        Builder<4> builder;
+        std::format_to(builder.appender(), "{}-{}", 12345, "abc");
+        std::ranges::copy(std::string_view("!?"), builder.appender());
+        CHECK(builder.str() == "12345-abc!?");
+
+        Builder<4> moved(MOVE(builder));
+        CHECK(moved.str() == "12345-abc!?");
+        CHECK(builder.empty());
+
+        Builder<64> small;
+        small += "abc";
+        Builder<64> moved_small(MOVE(small));
+        moved_small += "def";
+        CHECK(moved_small.str() == "abcdef");
+        CHECK(moved_small.piece(0).data() != small.piece(0).data());
+    }
+
+#ifndef _WIN32
+    SUBCASE("iovec list") {
+        Builder<4> builder;
+        for (int i = 0; i < 10; ++i) builder.append("0123456789");
+
+        std::array<iovec, 2> iov{};
+        std::string joined;
+        for (std::size_t first = 0; first < builder.piece_count();) {
+            const std::size_t count = builder.to_iovec(iov, first);
+            for (std::size_t i = 0; i < count; ++i) {
+                joined.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            }
+            first += count;
+        }
+        CHECK(joined == builder.str());
+    }
+#endif // _WIN32
+}
+
 constexpr std::string_view sv = "Hello, World!";
 constexpr std::string_view sv2 = "Hello, World!";
 constexpr std::string_view sv3 = "Hello, World!";
@@ -379,3 +1038,265 @@ TEST_CASE("StringViewBuilder") {
         CHECK(strcmp(c_str, "") == 0);
     }
 }
+
+TEST_CASE("perfect hashing") {
+    static constexpr auto commands = make_perfect_hash("get", "set", "delete", "exists", "expire", "incr", "decr");
+    static_assert(commands.match("get") == 0);
+    static_assert(commands.match("decr") == 6);
+    static_assert(commands.match("gets") == PerfectHash<7>::npos);
+    static_assert(!commands.contains(""));
+
+    for (std::size_t i = 0; i < commands.size(); ++i) CHECK(commands.match(commands.key(i)) == i);
+    CHECK(commands.match(std::string("expire")) == 4);
+    CHECK(commands.match("GET") == commands.npos);
+    CHECK(commands.match("ge") == commands.npos);
+
+    switch (commands.match(std::string_view("incr"))) {
+    case commands.match("get"): FAIL("matched get"); break;
+    case commands.match("incr"): break;
+    default: FAIL("matched nothing"); break;
+    }
+
+    // Keys that share long prefixes, built at runtime
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < 500; ++i) names.push_back("X-Custom-Header-" + std::to_string(i * 7919));
+    std::array<std::string_view, 500> keys{};
+    std::ranges::copy(names, keys.begin());
+    const PerfectHash<500> many(keys);
+    for (std::size_t i = 0; i < keys.size(); ++i) CHECK(many.match(names[i]) == i);
+    CHECK(many.match("X-Custom-Header-1") == many.npos);
+    CHECK(many.match("X-Custom-Header-") == many.npos);
+
+    static constexpr auto single = make_perfect_hash("only");
+    static_assert(single.match("only") == 0);
+    static_assert(single.match("other") == single.npos);
+    static_assert(PerfectHash<0>({}).match("any") == PerfectHash<0>::npos);
+
+    static_assert(perfect_hash<sv, cv4>.match("Hello, World!") == 0);
+    static_assert(perfect_hash<sv, cv4>.match("") == 1);
+}
+
+TEST_CASE("interning") {
+    Interner interner;
+    CHECK(interner.empty());
+    CHECK(interner.find("GET") == Interner::npos);
+
+    const Interner::Id get = interner.intern("GET");
+    const Interner::Id post = interner.intern(std::string("POST"));
+    CHECK(get != post);
+    CHECK(interner.intern("GET") == get);
+    CHECK(interner.find("POST") == post);
+    CHECK(interner.contains("GET"));
+    CHECK(!interner.contains("get"));
+    CHECK(interner.view(get) == "GET");
+    CHECK(interner.size() == 2);
+
+    const Interner::Id empty = interner.intern("");
+    CHECK(interner.view(empty).empty());
+    CHECK(interner.intern(std::string_view()) == empty);
+
+    // The copies do not depend on the strings they were made from
+    std::string key = "temporary";
+    const Interner::Id temporary = interner.intern(key);
+    key = "overwritten";
+    CHECK(interner.view(temporary) == "temporary");
+
+    // Enough keys to grow the tables and segments of every shard several times
+    std::vector<Interner::Id> ids;
+    for (std::size_t i = 0; i < 20000; ++i) ids.push_back(interner.intern("key-" + std::to_string(i)));
+    CHECK(interner.size() == 20004);
+    for (std::size_t i = 0; i < ids.size(); ++i) {
+        CHECK(interner.view(ids[i]) == "key-" + std::to_string(i));
+        CHECK(interner.find("key-" + std::to_string(i)) == ids[i]);
+    }
+    CHECK(interner.view(get) == "GET");
+    CHECK(interner.find("key-20000") == Interner::npos);
+
+    std::array<std::byte, 1024> buffer{};
+    std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+    Interner on_arena(&arena);
+    CHECK(on_arena.view(on_arena.intern("header")) == "header");
+}
+
+namespace {
+
+void intern_from_threads(Interner& interner) {
+    constexpr std::size_t thread_count = 4;
+    constexpr std::size_t key_count = 5000;
+
+    // Every thread interns the same keys in a different order and looks up the ones it has seen
+    std::array<std::vector<Interner::Id>, thread_count> ids;
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&interner, &ids, t] {
+            ids[t].resize(key_count);
+            for (std::size_t n = 0; n < key_count; ++n) {
+                const std::size_t i = (n * 7919 + t * 1237) % key_count;
+                const std::string key = "key-" + std::to_string(i);
+                ids[t][i] = interner.intern(key);
+                if (interner.find(key) != ids[t][i] || interner.view(ids[t][i]) != key) ids[t][i] = Interner::npos;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    CHECK(interner.size() == key_count);
+    for (std::size_t t = 1; t < thread_count; ++t) CHECK(ids[t] == ids[0]);
+    for (std::size_t i = 0; i < key_count; ++i) CHECK(interner.view(ids[0][i]) == "key-" + std::to_string(i));
+}
+
+// A bump allocator without any locking, like most arenas a caller would pass in
+class CallerArena final : public std::pmr::memory_resource {
+public:
+    explicit CallerArena(const std::size_t capacity) : m_buffer(capacity) {}
+
+    [[nodiscard]] std::size_t allocations() const noexcept {
+        return m_allocations;
+    }
+
+private:
+    void* do_allocate(const std::size_t bytes, const std::size_t alignment) override {
+        void* ptr = m_buffer.data() + m_used;
+        std::size_t space = m_buffer.size() - m_used;
+        if (std::align(alignment, bytes, ptr, space) == nullptr) throw std::bad_alloc();
+        m_used = m_buffer.size() - space + bytes;
+        ++m_allocations;
+        return ptr;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+    [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::vector<std::byte> m_buffer;
+    std::size_t m_used = 0;
+    std::size_t m_allocations = 0;
+};
+
+} // namespace
+
+TEST_CASE("interning from many threads") {
+    SUBCASE("default resource") {
+        Interner interner;
+        intern_from_threads(interner);
+    }
+
+    // The caller's arena is not thread safe, all shards share it
+    SUBCASE("caller arena") {
+        CallerArena arena(std::size_t{16} << 20);
+        Interner interner(&arena);
+        intern_from_threads(interner);
+        CHECK(arena.allocations() > Interner::shard_count);
+    }
+}
+
+#ifndef _WIN32
+namespace {
+
+std::vector<std::string> read_records(LineReader& reader) {
+    std::vector<std::string> records;
+    for (const std::string_view record : reader) records.emplace_back(record);
+    return records;
+}
+
+void write_file(const std::string& filename, const std::string_view contents) {
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    REQUIRE(file != nullptr);
+    std::fwrite(contents.data(), 1, contents.size(), file);
+    std::fclose(file);
+}
+
+} // namespace
+
+TEST_CASE("reading lines") {
+    const std::string filename = "test_string_lines.txt";
+
+    SUBCASE("mapped file") {
+        write_file(filename, "first\n\nthird\r\nlast without newline");
+        auto reader = LineReader::open(filename);
+        REQUIRE(reader.has_value());
+        CHECK(reader->mapped());
+        CHECK(read_records(*reader) == std::vector<std::string>{ "first", "", "third\r", "last without newline" });
+        CHECK(reader->error() == 0);
+    }
+
+    SUBCASE("empty file and trailing delimiter") {
+        write_file(filename, "");
+        auto empty = LineReader::open(filename);
+        REQUIRE(empty.has_value());
+        CHECK(read_records(*empty).empty());
+
+        write_file(filename, "only\n");
+        auto single = LineReader::open(filename);
+        REQUIRE(single.has_value());
+        CHECK(read_records(*single) == std::vector<std::string>{ "only" });
+    }
+
+    SUBCASE("custom delimiter") {
+        write_file(filename, std::string_view("a=1\0b=2\0\0c=3", 13));
+        auto reader = LineReader::open(filename, '\0');
+        REQUIRE(reader.has_value());
+        CHECK(read_records(*reader) == std::vector<std::string>{ "a=1", "b=2", "", "c=3" });
+    }
+
+    SUBCASE("records crossing chunks") {
+        // Records of every length around the chunk size, some longer than a whole chunk
+        std::string contents;
+        std::vector<std::string> expected;
+        for (std::size_t i = 0; i < 300; ++i) {
+            expected.push_back(std::string((i * 37) % 9000, static_cast<char>('a' + i % 26)));
+            contents += expected.back() + '\n';
+        }
+        write_file(filename, contents);
+
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        REQUIRE(fd >= 0);
+        LineReader reader(fd, '\n', 4096);
+        CHECK(!reader.mapped());
+        CHECK(read_records(reader) == expected);
+        ::close(fd);
+
+        auto mapped = LineReader::open(filename, '\n', 4096);
+        REQUIRE(mapped.has_value());
+        CHECK(read_records(*mapped) == expected);
+    }
+
+    SUBCASE("pipe") {
+        std::array<int, 2> fds{};
+        REQUIRE(::pipe(fds.data()) == 0);
+        std::thread writer([fd = fds[1]] {
+            for (int i = 0; i < 1000; ++i) {
+                const std::string line = "line " + std::to_string(i) + "\n";
+                // Split every line over two writes so records arrive in pieces
+                UNUSED(::write(fd, line.data(), 3));
+                UNUSED(::write(fd, line.data() + 3, line.size() - 3));
+            }
+            ::close(fd);
+        });
+
+        LineReader reader(fds[0]);
+        std::size_t count = 0;
+        std::string_view record;
+        while (reader.next(record)) CHECK(record == "line " + std::to_string(count++));
+        writer.join();
+        ::close(fds[0]);
+        CHECK(count == 1000);
+        CHECK(reader.error() == 0);
+    }
+
+    SUBCASE("errors") {
+        const auto missing = LineReader::open("non_existent_directory/lines.txt");
+        REQUIRE(!missing.has_value());
+        CHECK(missing.error().find("non_existent_directory/lines.txt") != std::string::npos);
+
+        LineReader closed(-1);
+        std::string_view record;
+        CHECK(!closed.next(record));
+        CHECK(closed.error() == EBADF);
+    }
+
+    std::remove(filename.c_str());
+}
+#endif // _WIN32
@@ -0,0 +1,54 @@
+// Converts a binary log file written through utils::log::BinaryFileSink to text.
+//
+// usage: log_decode <file> [output]
+
+#include "log.hpp"
+
+#include <expected>
+#include <fstream>
+#include <print>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// Replaces an existing output file, FdSink::open would append to it
+std::expected<utils::log::FdSink, std::string> open_output(const std::string& path) {
+#ifdef _WIN32
+    const int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif // _WIN32
+    if (fd < 0) return std::unexpected(utils::log::detail::errno_message("Could not open output file", path));
+    return utils::log::FdSink(fd, true);
+}
+
+} // namespace
+
+int main(const int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        std::println(stderr, "usage: {} <file> [output]", argv[0]);
+        return 1;
+    }
+
+    std::ifstream file(argv[1], std::ios::binary);
+    if (!file) {
+        std::println(stderr, "Could not open '{}'", argv[1]);
+        return 1;
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    const std::string data = contents.str();
+
+    auto output = argc == 3 ? open_output(argv[2]) : utils::log::FdSink(1);
+    if (!output) {
+        std::println(stderr, "{}", output.error());
+        return 1;
+    }
+
+    if (const auto result = utils::log::decode_binary(data, *output); !result) {
+        std::println(stderr, "{}: {}", argv[1], result.error());
+        return 1;
+    }
+    return 0;
+}